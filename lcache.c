@@ -21,13 +21,19 @@
  */
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <execinfo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "lmemory.h"
 #include <llib/ldict.h>
@@ -35,169 +41,5148 @@
 #include "lhash.h"
 #include "lthread.h"
 
+#define L_CACHE_KEY_INLINE 32    /**< key bytes an item can hold itself */
+
+typedef struct _LCacheItem LCacheItem;
+typedef struct _LCacheItem* LCacheItemP;
+typedef struct _LCache* LCacheP;
+typedef void * (*ThreadProc) (void * arg);
+
+struct _LCacheItem
+{
+    lpointer value;
+    uint64_t last_accessed; /**< milliseconds on the cache clock */
+    unsigned long access_count; /**< L_CACHE_LFU: accesses, halved as the cache ages */
+    double cost;        /**< price of rebuilding the value, see l_cache_put_with_cost() */
+    size_t size;        /**< size of the value, at least 1 */
+    double priority;    /**< L_CACHE_GDSF: inflation + access_count * cost / size */
+    lpointer key;       /**< storage key, needed to drop the entry on eviction */
+    LCacheItemP prev;   /**< neighbour towards the most recently used end */
+    LCacheItemP next;   /**< neighbour towards the least recently used end */
+    uint64_t hash;      /**< key hash, remembered by the ghost lists */
+    unsigned char key_owned;    /**< \e key is a heap copy of the caller's key */
+    unsigned char segment;  /**< policy defined list the item belongs to */
+    unsigned char referenced;   /**< L_CACHE_CAR reference bit, set atomically on hits */
+    int node;           /**< L_CACHE_LIRS node, slot in the sampled item array or in the GDSF heap */
+    struct _LCacheFrequency * bucket;   /**< L_CACHE_LFU bucket of \e access_count */
+    unsigned char windowed;     /**< in the admission window rather than the policy */
+    LCacheItemP chain;  /**< next item of the lock-free bucket */
+    LCacheItemP retired_next;   /**< next item waiting for the lock-free readers */
+    uint64_t retired;   /**< reclamation epoch the item was removed in */
+    LCacheItemP timer_prev;     /**< neighbours in the timing wheel slot */
+    LCacheItemP timer_next;
+    uint64_t expires;   /**< tick the item is filed under */
+    int timer_slot;     /**< timing wheel slot + 1, 0 when not filed */
+    uint32_t ttl;       /**< time-to-live in milliseconds, 0 when the item does not expire */
+    uint64_t stored;    /**< when the value was stored, for refresh-ahead */
+    unsigned char refreshing;   /**< a reload of the value is queued */
+    unsigned char slabbed;      /**< carved from a slab of the cache rather than the heap */
+    size_t weight;      /**< bytes charged to the cache weight, overhead included */
+    char key_inline[];  /**< copy of a short key, \e key points here; only allocated by the
+                             caches copying their keys, see _cache_item_size() */
+};
+
+/** \internal
+ * Intrusive doubly linked list of cache items, most recently used first.
+ */
+typedef struct _LCacheList
+{
+    LCacheItemP head;
+    LCacheItemP tail;
+    int length;
+} LCacheList;
+
+/** \internal
+ * L_CACHE_LFU bucket: the items sharing one access count, most recently
+ * used first. Buckets are chained by increasing count.
+ */
+typedef struct _LCacheFrequency
+{
+    unsigned long count;
+    LCacheList items;
+    struct _LCacheFrequency * prev;     /**< lower count */
+    struct _LCacheFrequency * next;     /**< higher count */
+} LCacheFrequency;
+
+/** \internal
+ * L_CACHE_PLRU set: a fixed number of ways probed by 16-bit hash tags.
+ * The tags, the access stamps and the tree bits share the first cache line,
+ * the keys and values of the ways the second one, so a set spans two lines
+ * and a lookup never chases a pointer.
+ */
+#define L_CACHE_PLRU_LEVELS 2
+#define L_CACHE_PLRU_WAYS (1 << L_CACHE_PLRU_LEVELS)
+
+typedef struct _LCachePlruSet
+{
+    uint16_t tags[L_CACHE_PLRU_WAYS];   /**< 0 for an empty way */
+    uint32_t stamps[L_CACHE_PLRU_WAYS]; /**< last access, seconds since the cache creation */
+    uint8_t tree;                       /**< tree-PLRU bits, one per inner node */
+    struct {
+        lpointer key;
+        lpointer value;
+    } ways[L_CACHE_PLRU_WAYS] __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64))) LCachePlruSet;
+
+/** \internal
+ * Header of a slab of items, at the start of its L_CACHE_SLAB_BYTES aligned
+ * block. The items follow, handed out in order until the first one is freed.
+ */
+#define L_CACHE_SLAB_BYTES 16384
+#define L_CACHE_HEAP_OVERHEAD (2 * sizeof (size_t))     /**< header of a heap block */
+#define L_CACHE_SLAB_HEADER ((sizeof (LCacheSlab) + 63) & ~(size_t)63)
+#define L_CACHE_SLAB_ITEMS(item_size) ((int)((L_CACHE_SLAB_BYTES - L_CACHE_SLAB_HEADER) / (item_size)))
+
+typedef struct _LCacheSlab
+{
+    struct _LCacheSlab * prev;  /**< neighbours among the slabs with free items */
+    struct _LCacheSlab * next;
+    LCacheItemP free;           /**< freed items, chained by \e chain */
+    int used;                   /**< items handed out */
+    int fresh;                  /**< items never handed out start at this index */
+    LCacheP cache;              /**< owner, for the LHash value destroy function */
+} LCacheSlab;
+
+/** \internal
+ * Slot of the flat storage. The control bytes live in their own array,
+ * 16 to a group, so a probe compares a group of tags in one instruction.
+ */
+#define L_CACHE_FLAT_GROUP 16
+#define L_CACHE_FLAT_EMPTY 0x80
+#define L_CACHE_FLAT_DELETED 0xfe
+#define L_CACHE_FLAT_SPARES 64     /**< removed items kept for reuse */
+#define L_CACHE_FLAT_MIGRATE 32     /**< slots moved by an operation during a resize */
+
+typedef struct _LCacheFlatSlot
+{
+    lpointer key;
+    LCacheItemP item;
+} LCacheFlatSlot;
+
+typedef struct _LCacheFlatTable
+{
+    uint8_t * ctrl;             /**< a control byte per slot */
+    LCacheFlatSlot * slots;
+    uint64_t mask;              /**< slots - 1 */
+    int length;                 /**< slots holding an item */
+    int growth_left;            /**< EMPTY slots that can be filled before a resize */
+} LCacheFlatTable;
+
+/** \internal
+ * TinyLFU frequency sketch: a count-min sketch of 4 rows of 4-bit counters,
+ * fronted by a doorkeeper bloom filter absorbing the keys seen only once.
+ * All counters are halved, and the doorkeeper cleared, every \e sample_size
+ * additions so the estimates follow the recent popularity.
+ */
+typedef struct _LCacheSketch
+{
+    uint64_t * table;           /**< the rows one after another, 16 counters per word */
+    uint32_t width_mask;        /**< counters per row - 1 */
+    uint64_t * doorkeeper;
+    uint32_t doorkeeper_mask;   /**< bits - 1 */
+    int additions;
+    int sample_size;
+} LCacheSketch;
+
+/** \internal
+ * Open addressing map from a key hash to a node of a policy owned pool.
+ */
+typedef struct _LCacheHashSlot
+{
+    uint64_t hash;
+    int node;       /**< node + 1, 0 when the slot is empty */
+} LCacheHashSlot;
+
+typedef struct _LCacheHashIndex
+{
+    LCacheHashSlot * slots;
+    int mask;
+} LCacheHashIndex;
+
+/** \internal
+ * A ghost entry: the hash of a recently evicted key, without its value.
+ */
+typedef struct _LCacheGhost
+{
+    uint64_t hash;
+    int prev;       /**< towards the most recently evicted end, -1 at the head */
+    int next;       /**< towards the least recently evicted end, -1 at the tail */
+    int list;       /**< ghost list holding the entry, -1 when free */
+} LCacheGhost;
+
+typedef struct _LCacheGhostList
+{
+    int head;
+    int tail;
+    int length;
+} LCacheGhostList;
+
+/** \internal
+ * Two bounded LRU lists of key hashes sharing a fixed pool of entries and
+ * an open addressing index, so their memory never grows past creation.
+ */
+typedef struct _LCacheGhosts
+{
+    LCacheGhost * nodes;
+    LCacheHashIndex index;
+    int capacity;       /**< number of nodes */
+    int free;           /**< free nodes, chained through next */
+    LCacheGhostList lists[2];
+} LCacheGhosts;
+
+/** \internal
+ * A LIRS block. Resident blocks point at their item, non-resident HIR
+ * blocks only remember the key hash while they stay in the stack S.
+ */
+typedef struct _LCacheLirsNode
+{
+    uint64_t hash;
+    LCacheItemP item;   /**< NULL for a non-resident block */
+    int sprev;          /**< towards the top of S, -1 at the top */
+    int snext;          /**< towards the bottom of S, -1 at the bottom, next free node */
+    int qprev;          /**< towards the newest end of Q or of the non-resident list */
+    int qnext;          /**< towards the oldest end of Q or of the non-resident list */
+    unsigned char state;
+    unsigned char in_s; /**< the block is in the stack S */
+} LCacheLirsNode;
+
+/** \internal
+ * Sampled eviction candidate, with the access time it was ranked by.
+ */
+#define L_CACHE_EVICTION_POOL 16
+
+typedef struct _LCacheCandidate
+{
+    LCacheItemP item;
+    uint64_t last_accessed;
+} LCacheCandidate;
+
+/** \internal
+ * Timing wheel geometry: 4 levels of 64 slots span 2^24 one millisecond
+ * ticks, about four hours and a half.
+ */
+#define L_CACHE_WHEEL_BITS 6
+#define L_CACHE_WHEEL_SLOTS (1 << L_CACHE_WHEEL_BITS)
+#define L_CACHE_WHEEL_LEVELS 4
+
+/** \internal
+ * A creator call of l_cache_get_or_put() in progress, that the other
+ * callers for the same key wait for under the partition lock.
+ */
+typedef struct _LCacheFlight
+{
+    lpointer key;
+    lpointer value;         /**< the creator result, once \e done */
+    bool done;
+    int waiters;
+    pthread_cond_t done_cond;
+    struct _LCacheFlight * next;
+} LCacheFlight;
+
+/** \internal
+ * A value reload queued by refresh-ahead.
+ */
+typedef struct _LCacheRefresh
+{
+    lpointer key;
+    LCacheObjectCreator creator;
+    struct _LCacheRefresh * next;
+} LCacheRefresh;
+
+/** \internal
+ * Keys handled per partition lock and per creator call by the batch
+ * functions.
+ */
+#define L_CACHE_BATCH 256
+
+/** \internal
+ * Monotonic clock of a cache in milliseconds. With a resolution, the timer
+ * thread keeps \e now up to date and the operations read it instead of
+ * the system clock; on a cache line of its own, shared by the partitions.
+ */
+typedef struct _LCacheClock
+{
+    uint64_t now;
+    int resolution;             /**< milliseconds between the updates of \e now */
+    bool ticking;               /**< \e now is kept by the timer thread */
+    LCacheP owner;              /**< the cache releasing the clock */
+} __attribute__ ((aligned (64))) LCacheClock;
+
+/** \internal
+ * Hit and miss counters of the lock-free lookups, one cache line per
+ * stripe so that each reader thread updates its own.
+ */
+#define L_CACHE_READ_STRIPES 64
+#define L_CACHE_LIMBO_MIN 32
+
+typedef struct _LCacheReadCounters
+{
+    unsigned long hits;
+    unsigned long misses;
+} __attribute__ ((aligned (64))) LCacheReadCounters;
+
+/** \internal
+ * Generation counter of a partition, on a cache line of its own since
+ * every front cache lookup reads it.
+ */
+typedef struct _LCacheGeneration
+{
+    uint64_t value;
+} __attribute__ ((aligned (64))) LCacheGeneration;
+
+/** \internal
+ * Slot of a thread-local front cache. A copy of the value of \e key is
+ * valid while \e source still holds \e generation, and until \e deadline
+ * if not 0; \e candidate is the key last found in the shared cache,
+ * \e count times in a row.
+ */
+typedef struct _LCacheFrontSlot
+{
+    lconstpointer key;
+    lpointer value;
+    uint64_t generation;
+    uint64_t deadline;          /**< milliseconds on the cache clock */
+    const LCacheGeneration * source;    /**< counter of the partition of \e key */
+    lconstpointer candidate;
+    int count;
+} LCacheFrontSlot;
+
+/** \internal
+ * The front cache of one thread for one cache.
+ */
+typedef struct _LCacheFront
+{
+    LCacheFrontSlot * slots;
+    unsigned long hits;         /**< written by the owner thread only */
+    LCacheP cache;
+    struct _LCacheFront * next; /**< the other threads of \e cache */
+} LCacheFront;
+
+/** \internal
+ * Replacement policy hooks. Every hook is O(1) and is called with the
+ * item already (or still) present in the storage.
+ */
+typedef struct _LCachePolicy
+{
+    void (*insert) (LCacheP cache, LCacheItemP item);   /**< a new item was stored */
+    void (*hit) (LCacheP cache, LCacheItemP item);      /**< an item was looked up or overwritten */
+    void (*remove) (LCacheP cache, LCacheItemP item);   /**< an item is about to leave the storage */
+    LCacheItemP (*victim) (LCacheP cache, LCacheItemP incoming); /**< pick the item to evict for \e incoming */
+    bool (*init) (LCacheP cache);       /**< optional, allocates the policy state */
+    void (*destroy) (LCacheP cache);    /**< optional, releases the policy state */
+    void (*age) (LCacheP cache);        /**< optional, called on every cleanup sweep */
+    void (*evict) (LCacheP cache, LCacheItemP victim);  /**< optional, the victim is evicted */
+} LCachePolicy;
+
 /** \internal
  * The structure comprising a cache object container.
  */
-struct _LCache
+struct _LCache
+{
+    LHash * storage;  /**< the table of lists in which the keys/values are stored */
+    int length;
+    int object_ttl;   /**< cache elemant time-to-live */
+    LCacheClock * clock;
+    int cleanup_delay;
+    pthread_t lru_tid;  /**< the cleanup thread, when \e cleaner.running */
+    struct {
+        pthread_mutex_t lock;
+        pthread_cond_t wake;    /**< signaled to stop the thread early */
+        bool running;
+        bool stopping;
+    } cleaner;
+    LCacheType type;  /**< replacement policy */
+    int capacity;     /**< maximum number of items, 0 when unbounded */
+    size_t weight;    /**< summed weight of the stored items */
+    size_t max_weight;    /**< weight budget, 0 when unbounded */
+    LCacheWeigher weigher;    /**< value weight, NULL to charge the size given to the put */
+    size_t item_overhead;     /**< bytes an item costs besides its value */
+    size_t item_size;         /**< bytes of an item, its inline key buffer included */
+    struct {
+        LCacheKeyType type;
+        size_t size;            /**< L_CACHE_KEY_BINARY key bytes */
+    } keys;
+    const LCachePolicy * policy;
+    LCacheList recency;   /**< LRU/MRU ordering */
+    struct {
+        LCacheList probation;   /**< items seen once */
+        LCacheList protect;     /**< items hit at least twice */
+        int protected_capacity; /**< ignored when the cache is unbounded */
+    } slru;
+    struct {                    /* L_CACHE_ARC and L_CACHE_CAR */
+        LCacheList t1;          /**< resident, seen once recently */
+        LCacheList t2;          /**< resident, seen at least twice recently */
+        LCacheGhosts ghosts;    /**< B1 and B2, evicted from T1 and T2 */
+        int p;                  /**< adaptive target size of T1 */
+        LCacheItemP pending;    /**< incoming item already classified by the victim hook */
+        int pending_ghost;      /**< ghost list \e pending was found in, or -1 */
+    } arc;
+    struct {
+        LCacheLirsNode * nodes;
+        LCacheHashIndex index;  /**< hash of every block in use */
+        int capacity;           /**< number of nodes */
+        int free;
+        LCacheGhostList s;      /**< recency stack, top at the head */
+        LCacheGhostList q;      /**< resident HIR blocks, the next victim at the tail */
+        LCacheGhostList nonresident;    /**< non-resident HIR blocks, oldest at the tail */
+        int lir_length;
+        int lir_capacity;
+        int nonresident_capacity;
+    } lirs;
+    struct {
+        LCacheFrequency * lowest;   /**< bucket holding the next victim */
+    } lfu;
+    struct {
+        LCacheSketch sketch;        /**< enabled when its table is not NULL */
+        LCacheList window;          /**< recent items not admitted to the policy yet */
+        int window_capacity;
+        unsigned long rejections;
+    } admission;
+    struct {                    /* L_CACHE_RR and sampled L_CACHE_LRU */
+        LCacheItemP * items;    /**< resident items, in no particular order */
+        int length;
+        int samples;            /**< items ranked per eviction, 0 to evict at random */
+        LCacheCandidate pool[L_CACHE_EVICTION_POOL];    /**< the oldest candidates seen, oldest last */
+        int pool_length;
+        uint64_t seed;          /**< xorshift state */
+    } sampled;
+    struct {
+        LCacheItemP * heap;     /**< binary min-heap on the item priorities */
+        int length;
+        double inflation;       /**< priority of the last victim */
+    } gdsf;
+    struct {
+        LCacheItemP * slots;        /**< the levels one after another, NULL until an item expires */
+        uint64_t epoch;             /**< clock time of tick 0 */
+        uint64_t now;               /**< tick being processed */
+        int level;                  /**< next level to process at \e now, -1 once done */
+        uint64_t occupied[L_CACHE_WHEEL_LEVELS];    /**< non-empty slots, a bit each */
+    } wheel;
+    int expire_batch;           /**< items handled by the expiration step of an insertion */
+    struct {
+        LCacheItemP * buckets;      /**< replaces \e storage when not NULL, read without \e lock */
+        uint64_t mask;
+        LCacheItemP limbo;          /**< removed items, newest first */
+        int limbo_length;
+        int limbo_goal;             /**< limbo length triggering a reclamation */
+    } rcu;
+    struct {
+        bool enabled;               /**< items are carved from slabs */
+        LCacheSlab * partial;       /**< slabs with free items, last freed into first */
+        LCacheSlab * empty;         /**< a released slab kept for the next allocations */
+        int count;                  /**< slabs allocated, \e empty included */
+        int used;                   /**< items handed out */
+    } slab;
+    struct {
+        LCacheFlatTable table;      /**< replaces \e storage when its \e ctrl is not NULL */
+        LCacheFlatTable old;        /**< being drained into \e table by a resize, or no \e ctrl */
+        uint64_t cursor;            /**< next slot of \e old to move */
+        LCacheItemP spares;         /**< removed items kept for reuse, chained by \e chain */
+        int spare_count;
+        unsigned long resizes;
+    } flat;
+    struct {
+        LCachePlruSet * sets;       /**< replaces \e storage when not NULL */
+        int set_count;
+        int cursor;                 /**< next set to expire */
+        uint64_t epoch;             /**< clock time of stamp 0 */
+    } plru;
+    LCacheP * shards;           /**< partitions of a concurrent cache, NULL otherwise */
+    int shard_bits;             /**< log2 of the number of partitions */
+    pthread_mutex_t lock;       /**< guards a partition */
+    bool locked;                /**< the cache is a partition, used under \e lock */
+    LCacheReadCounters * read_counters; /**< lock-free lookups enabled when not NULL */
+    LCacheFlight * flights;     /**< loads in progress in a partition */
+    unsigned long coalesced;
+    struct {
+        double ahead;               /**< share of the ttl a value is reloaded at */
+        double beta;                /**< XFetch weight of the rebuild cost, 0 disables the draws */
+        uint64_t seed;              /**< xorshift state of the draws */
+        pthread_t * threads;        /**< the worker pool, NULL when refresh-ahead is off */
+        int count;
+        pthread_mutex_t lock;       /**< guards the queue */
+        pthread_cond_t wake;
+        LCacheRefresh * queue;      /**< reloads to run, oldest first */
+        LCacheRefresh ** tail;
+        bool stopping;
+    } refresh;
+    unsigned long refreshes;
+    struct {
+        int slots;                  /**< per thread, 0 disables the front caches */
+        int promotion;              /**< shared hits in a row copying a value to the front */
+        pthread_key_t key;          /**< the LCacheFront of the calling thread */
+        pthread_mutex_t lock;       /**< guards \e tables */
+        LCacheFront * tables;
+        unsigned long retired_hits; /**< of the exited threads */
+        LCacheGeneration * generations; /**< one per partition */
+    } front;
+    LCacheGeneration * generation;  /**< of a partition, NULL without front caches */
+    unsigned long expirations;
+    double expire_time_max;     /**< microseconds */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    double evicted_cost;
+    unsigned long loads;
+    double load_time;           /**< microseconds spent in the creators */
+};
+
+enum
+{
+    L_CACHE_SEGMENT_PROBATION,
+    L_CACHE_SEGMENT_PROTECTED
+};
+
+enum
+{
+    L_CACHE_SEGMENT_T1,
+    L_CACHE_SEGMENT_T2
+};
+
+enum
+{
+    L_CACHE_GHOST_B1,
+    L_CACHE_GHOST_B2
+};
+
+enum
+{
+    L_CACHE_SAMPLED_RESIDENT,
+    L_CACHE_SAMPLED_POOLED      /**< also in the eviction pool */
+};
+
+enum
+{
+    L_CACHE_LIRS_FREE,
+    L_CACHE_LIRS_LIR,
+    L_CACHE_LIRS_HIR,           /**< resident HIR block, in Q */
+    L_CACHE_LIRS_NONRESIDENT    /**< evicted HIR block still in S */
+};
+//extern void _l_hash_dump(LHash * hash);
+
+
+/* recency list helpers */
+
+static void
+_list_push_head (LCacheList * list, LCacheItemP item)
+{
+    item->prev = NULL;
+    item->next = list->head;
+    if (list->head) {
+        list->head->prev = item;
+    } else {
+        list->tail = item;
+    }
+    list->head = item;
+    list->length++;
+}
+
+static void
+_list_unlink (LCacheList * list, LCacheItemP item)
+{
+    if (item->prev) {
+        item->prev->next = item->next;
+    } else {
+        list->head = item->next;
+    }
+    if (item->next) {
+        item->next->prev = item->prev;
+    } else {
+        list->tail = item->prev;
+    }
+    item->prev = item->next = NULL;
+    list->length--;
+}
+
+static void
+_list_move_to_head (LCacheList * list, LCacheItemP item)
+{
+    if (list->head != item) {
+        _list_unlink(list, item);
+        _list_push_head(list, item);
+    }
+}
+
+/**
+ * Hashes an integer cache key. Such keys are compared by identity, like the
+ * storage does, so the pointer bits are mixed with the 64-bit murmur3
+ * finalizer.
+ */
+static uint64_t
+_cache_key_hash (lconstpointer key)
+{
+    uint64_t h = (uint64_t)(uintptr_t)key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* key modes: integer keys are compared by identity and hashed by
+ * _cache_key_hash(); string and binary keys are compared by content and
+ * hashed with wyhash. The full hash is kept in the item, so resizes and
+ * probes compare hashes and only read the key bytes of a matching one */
+
+static const uint64_t _wyp[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static inline uint64_t
+_wymix (uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t) a * b;
+
+    return (uint64_t) r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+_wyr8 (const uint8_t * p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+_wyr4 (const uint8_t * p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/**
+ * wyhash (final version 4) of the \e len bytes at \e key.
+ */
+static uint64_t
+_wyhash (const void * key, size_t len)
+{
+    const uint8_t * p = key;
+    uint64_t seed = _wymix(_wyp[0], _wyp[1]);
+    uint64_t a, b;
+    __uint128_t r;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (_wyr4(p) << 32) | _wyr4(p + ((len >> 3) << 2));
+            b = (_wyr4(p + len - 4) << 32) | _wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+
+            do {
+                seed = _wymix(_wyr8(p) ^ _wyp[1], _wyr8(p + 8) ^ seed);
+                see1 = _wymix(_wyr8(p + 16) ^ _wyp[2], _wyr8(p + 24) ^ see1);
+                see2 = _wymix(_wyr8(p + 32) ^ _wyp[3], _wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = _wymix(_wyr8(p) ^ _wyp[1], _wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = _wyr8(p + i - 16);
+        b = _wyr8(p + i - 8);
+    }
+    r = (__uint128_t)(a ^ _wyp[1]) * (b ^ seed);
+    return _wymix((uint64_t) r ^ _wyp[0] ^ len, (uint64_t)(r >> 64) ^ _wyp[1]);
+}
+
+/**
+ * Returns the bytes of \e key, its terminating NUL included, 0 for an
+ * integer key.
+ */
+static inline size_t
+_key_length (LCacheP cache, lconstpointer key)
+{
+    switch (cache->keys.type) {
+    case L_CACHE_KEY_STRING:
+    case L_CACHE_KEY_STRING_COPY:
+        return strlen(key) + 1;
+    case L_CACHE_KEY_BINARY:
+        return cache->keys.size;
+    default:
+        return 0;
+    }
+}
+
+static inline uint64_t
+_cache_hash (LCacheP cache, lconstpointer key)
+{
+    if (cache->keys.type == L_CACHE_KEY_INT) {
+        return _cache_key_hash(key);
+    }
+    return _wyhash(key, cache->keys.type == L_CACHE_KEY_BINARY ? cache->keys.size : strlen(key));
+}
+
+static inline bool
+_key_equal (LCacheP cache, lconstpointer a, lconstpointer b)
+{
+    switch (cache->keys.type) {
+    case L_CACHE_KEY_STRING:
+    case L_CACHE_KEY_STRING_COPY:
+        return a == b || 0 == strcmp(a, b);
+    case L_CACHE_KEY_BINARY:
+        return a == b || 0 == memcmp(a, b, cache->keys.size);
+    default:
+        return a == b;
+    }
+}
+
+/**
+ * Returns whether \e item, stored under \e stored, holds \e key of
+ * \e hash. Content compared keys are only read when the hashes match.
+ */
+static inline bool
+_key_matches (LCacheP cache, lconstpointer stored, LCacheItemP item, lconstpointer key,
+              uint64_t hash)
+{
+    if (cache->keys.type == L_CACHE_KEY_INT) {
+        return stored == key;
+    }
+    return item->hash == hash && _key_equal(cache, stored, key);
+}
+
+/**
+ * Makes \e item hold its own copy of \e key, in place when it is short.
+ */
+static bool
+_item_copy_key (LCacheP cache, LCacheItemP item, lconstpointer key)
+{
+    size_t length = _key_length(cache, key);
+
+    if (length <= cache->item_size - offsetof (LCacheItem, key_inline)) {
+        item->key = memcpy(item->key_inline, key, length);
+        return true;
+    }
+    item->key = l_calloc (length, 1);
+    if (NULL == item->key) {
+        return false;
+    }
+    memcpy(item->key, key, length);
+    item->key_owned = 1;
+    return true;
+}
+
+/**
+ * Releases the key copy of \e item kept outside of the item.
+ */
+static inline void
+_item_free_key (LCacheItemP item)
+{
+    if (item->key_owned) {
+        l_free(item->key);
+        item->key_owned = 0;
+    }
+}
+
+/* item slabs: the items of a cache are carved from aligned 16 KB slabs
+ * instead of one heap block each. A slab holds its free items in a list,
+ * and the slabs with free items are chained, the one freed into last
+ * first, so that allocations refill the slabs in use. A slab is released
+ * once its last item is freed, except for one kept for the next
+ * allocations; the slab of an item is found by masking its address */
+
+static inline LCacheSlab *
+_slab_of (LCacheItemP item)
+{
+    return (LCacheSlab *)((uintptr_t) item & ~(uintptr_t)(L_CACHE_SLAB_BYTES - 1));
+}
+
+static inline LCacheItemP
+_slab_item (LCacheSlab * slab, size_t item_size, int index)
+{
+    return (LCacheItemP)((uint8_t *) slab + L_CACHE_SLAB_HEADER + index * item_size);
+}
+
+static void
+_slab_unlink (LCacheP cache, LCacheSlab * slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cache->slab.partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
+
+static void
+_slab_push (LCacheP cache, LCacheSlab * slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->slab.partial;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    cache->slab.partial = slab;
+}
+
+static LCacheSlab *
+_slab_new (LCacheP cache)
+{
+    void * memory = NULL;
+    LCacheSlab * slab;
+
+    if (posix_memalign(&memory, L_CACHE_SLAB_BYTES, L_CACHE_SLAB_BYTES)) {
+        return NULL;
+    }
+    /* the items are only touched when first handed out */
+    slab = memset(memory, 0, sizeof (LCacheSlab));
+    slab->cache = cache;
+    cache->slab.count++;
+    return slab;
+}
+
+/**
+ * Returns a zeroed item from the slabs of \e cache.
+ */
+static LCacheItemP
+_slab_alloc (LCacheP cache)
+{
+    LCacheSlab * slab = cache->slab.partial;
+    LCacheItemP item;
+
+    if (NULL == slab) {
+        slab = cache->slab.empty ? cache->slab.empty : _slab_new(cache);
+        if (NULL == slab) {
+            return NULL;
+        }
+        cache->slab.empty = NULL;
+        _slab_push(cache, slab);
+    }
+    if (slab->free) {
+        item = slab->free;
+        slab->free = item->chain;
+    } else {
+        item = _slab_item(slab, cache->item_size, slab->fresh++);
+    }
+    if (++slab->used == L_CACHE_SLAB_ITEMS (cache->item_size)) {
+        _slab_unlink(cache, slab);
+    }
+    cache->slab.used++;
+    memset(item, 0, sizeof (LCacheItem));
+    item->slabbed = 1;
+    return item;
+}
+
+static void
+_slab_free (LCacheItemP item)
+{
+    LCacheSlab * slab = _slab_of(item);
+    LCacheP cache = slab->cache;
+
+    item->chain = slab->free;
+    slab->free = item;
+    cache->slab.used--;
+    if (slab->used-- == L_CACHE_SLAB_ITEMS (cache->item_size)) {
+        _slab_push(cache, slab);
+    }
+    if (slab->used > 0) {
+        return;
+    }
+    _slab_unlink(cache, slab);
+    if (NULL == cache->slab.empty) {
+        cache->slab.empty = slab;
+        return;
+    }
+    cache->slab.count--;
+    free(slab);
+}
+
+static void
+_slab_destroy (LCacheP cache)
+{
+    /* the storage returned every item: the slabs left are empty */
+    while (cache->slab.partial) {
+        LCacheSlab * slab = cache->slab.partial;
+        cache->slab.partial = slab->next;
+        free(slab);
+    }
+    free(cache->slab.empty);
+    cache->slab.empty = NULL;
+}
+
+/**
+ * Releases \e item to the slabs or the heap it was allocated from.
+ */
+static void
+_item_free (LCacheItemP item)
+{
+    _item_free_key(item);
+    if (item->slabbed) {
+        _slab_free(item);
+    } else {
+        l_free(item);
+    }
+}
+
+/* lock-free lookups: the partitions of a read-optimized cache chain their
+ * items in a fixed bucket array that l_cache_get() walks without the lock.
+ * Removed items are retired with the current epoch and only freed once
+ * every reader has entered a later one */
+
+/** \internal
+ * A thread doing lock-free lookups: the epoch its lookup started in, 0
+ * outside of them. Records are never freed, a new thread reuses the record
+ * of an exited one.
+ */
+typedef struct _LCacheReader
+{
+    uint64_t epoch;
+    int slot;               /**< counter stripe of the thread */
+    bool used;
+    struct _LCacheReader * next;
+} __attribute__ ((aligned (64))) LCacheReader;
+
+static uint64_t _gReclaimEpoch = 1;
+static LCacheReader * _gReaders = NULL;
+static int _gReaderCount = 0;
+static pthread_key_t _gReaderKey;
+static pthread_once_t _gReaderOnce = PTHREAD_ONCE_INIT;
+static __thread LCacheReader * _tReader = NULL;
+
+static void
+_reader_release (void * data)
+{
+    LCacheReader * reader = data;
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&reader->used, false, __ATOMIC_RELEASE);
+}
+
+static void
+_reader_key_create (void)
+{
+    pthread_key_create(&_gReaderKey, _reader_release);
+}
+
+/**
+ * Returns the reader record of the calling thread, or NULL if out of memory.
+ */
+static LCacheReader *
+_reader_self (void)
+{
+    LCacheReader * reader;
+    void * memory = NULL;
+
+    if (_tReader) {
+        return _tReader;
+    }
+    pthread_once(&_gReaderOnce, _reader_key_create);
+    for (reader = __atomic_load_n(&_gReaders, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&reader->used, &expected, true, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (NULL == reader) {
+        if (posix_memalign(&memory, 64, sizeof (LCacheReader))) {
+            return NULL;
+        }
+        reader = memset(memory, 0, sizeof (LCacheReader));
+        reader->used = true;
+        reader->slot = __atomic_fetch_add(&_gReaderCount, 1, __ATOMIC_RELAXED);
+        reader->next = __atomic_load_n(&_gReaders, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_gReaders, &reader->next, reader, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(_gReaderKey, reader);
+    _tReader = reader;
+    return reader;
+}
+
+static void
+_reader_enter (LCacheReader * reader)
+{
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&_gReclaimEpoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    /* pairs with the fence of _rcu_reclaim(): either the writer sees this
+     * reader, or the reader sees the item unlinked */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void
+_reader_exit (LCacheReader * reader)
+{
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Allocates a bucket per expected item of \e cache: the buckets never grow.
+ */
+static bool
+_rcu_init (LCacheP cache, int items)
+{
+    uint64_t buckets = 16;
+
+    while (buckets < (uint64_t)items) {
+        buckets <<= 1;
+    }
+    cache->rcu.buckets = l_calloc (sizeof (LCacheItemP), buckets);
+    if (NULL == cache->rcu.buckets) {
+        return false;
+    }
+    cache->rcu.mask = buckets - 1;
+    cache->rcu.limbo_goal = L_CACHE_LIMBO_MIN;
+    return true;
+}
+
+/**
+ * Frees the retired items no reader can still hold.
+ */
+static void
+_rcu_reclaim (LCacheP cache)
+{
+    LCacheReader * reader;
+    LCacheItemP * link = &cache->rcu.limbo;
+    uint64_t oldest = UINT64_MAX;
+
+    __atomic_add_fetch(&_gReclaimEpoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (reader = __atomic_load_n(&_gReaders, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        uint64_t epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (epoch && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    while (*link) {
+        LCacheItemP item = *link;
+        if (item->retired < oldest) {
+            *link = item->retired_next;
+            cache->rcu.limbo_length--;
+            _item_free(item);
+        } else {
+            link = &item->retired_next;
+        }
+    }
+    /* a stalled reader keeps items in limbo: retry after as many removals */
+    cache->rcu.limbo_goal = 2 * cache->rcu.limbo_length;
+    if (cache->rcu.limbo_goal < L_CACHE_LIMBO_MIN) {
+        cache->rcu.limbo_goal = L_CACHE_LIMBO_MIN;
+    }
+}
+
+static void
+_rcu_destroy (LCacheP cache)
+{
+    uint64_t i;
+
+    for (i = 0; i <= cache->rcu.mask; i++) {
+        while (cache->rcu.buckets[i]) {
+            LCacheItemP item = cache->rcu.buckets[i];
+            cache->rcu.buckets[i] = item->chain;
+            _item_free(item);
+        }
+    }
+    while (cache->rcu.limbo) {
+        LCacheItemP item = cache->rcu.limbo;
+        cache->rcu.limbo = item->retired_next;
+        _item_free(item);
+    }
+    l_free(cache->rcu.buckets);
+    cache->rcu.buckets = NULL;
+}
+
+/* flat storage: an open addressing table of (key, item) slots, Swiss-table
+ * style. A control byte per slot holds EMPTY, DELETED or the low 7 bits of
+ * the key hash; the bytes of 16 slots form a group compared at once with
+ * SSE2, and the rest of the hash selects the first group probed. A lookup
+ * reads one line of control bytes and, for a matching tag, the slot.
+ * Removed items are kept for the next insertions, so a full cache replaces
+ * its items without allocating. A full table is replaced by a larger one
+ * and its items move a few slots per operation: meanwhile, lookups try the
+ * new table then the old one */
+
+/**
+ * Returns the slots of \e group whose control byte is \e tag, a bit each.
+ */
+static inline uint32_t
+_flat_match (const uint8_t * group, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *) group);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) tag)));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < L_CACHE_FLAT_GROUP; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Returns the slots of \e group that hold no item: EMPTY and DELETED both
+ * have the high bit set.
+ */
+static inline uint32_t
+_flat_match_free (const uint8_t * group)
+{
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *) group));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < L_CACHE_FLAT_GROUP; i++) {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Allocates \e table with \e slots slots, a power of two of at least one
+ * group. The slots follow the control bytes and are left uninitialized:
+ * only the control bytes are written, so a resize does not clear the
+ * whole new table at once.
+ */
+static bool
+_flat_alloc (LCacheFlatTable * table, uint64_t slots)
+{
+    void * memory = NULL;
+
+    if (posix_memalign(&memory, 64, slots * (1 + sizeof (LCacheFlatSlot)))) {
+        return false;
+    }
+    table->slots = (LCacheFlatSlot *)((uint8_t *) memory + slots);
+    table->ctrl = memset(memory, L_CACHE_FLAT_EMPTY, slots);
+    table->mask = slots - 1;
+    table->length = 0;
+    table->growth_left = slots - slots / 8;
+    return true;
+}
+
+static void
+_flat_free (LCacheFlatTable * table)
+{
+    free(table->ctrl);
+    table->ctrl = NULL;
+    table->slots = NULL;
+}
+
+/**
+ * Sizes the table of \e cache for \e items items at the maximum load of 7/8.
+ */
+static bool
+_flat_init (LCacheP cache, int items)
+{
+    uint64_t slots = L_CACHE_FLAT_GROUP;
+
+    while (slots - slots / 8 < (uint64_t)items) {
+        slots <<= 1;
+    }
+    return _flat_alloc(&cache->flat.table, slots);
+}
+
+/**
+ * Returns the slot of \e key in \e table, -1 if it is not there.
+ */
+static int64_t
+_flat_find (LCacheP cache, const LCacheFlatTable * table, lconstpointer key, uint64_t hash)
+{
+    uint64_t groups = table->mask / L_CACHE_FLAT_GROUP;
+    uint64_t group = (hash >> 7) & groups;
+    uint64_t step = 0;
+
+    for (;;) {
+        const uint8_t * ctrl = &table->ctrl[group * L_CACHE_FLAT_GROUP];
+        uint32_t match = _flat_match(ctrl, hash & 0x7f);
+
+        while (match) {
+            uint64_t slot = group * L_CACHE_FLAT_GROUP + __builtin_ctz(match);
+
+            if (_key_matches(cache, table->slots[slot].key, table->slots[slot].item, key, hash)) {
+                return slot;
+            }
+            match &= match - 1;
+        }
+        /* an EMPTY byte ends the probe sequence of every key */
+        if (_flat_match(ctrl, L_CACHE_FLAT_EMPTY)) {
+            return -1;
+        }
+        /* triangular probing visits every group of a power of two table */
+        group = (group + ++step) & groups;
+    }
+}
+
+/**
+ * Files \e key and \e item in the first free slot of the probe sequence of
+ * \e hash.
+ */
+static void
+_flat_place (LCacheFlatTable * table, lpointer key, LCacheItemP item, uint64_t hash)
+{
+    uint64_t groups = table->mask / L_CACHE_FLAT_GROUP;
+    uint64_t group = (hash >> 7) & groups;
+    uint64_t step = 0;
+    uint64_t slot;
+    uint32_t free_slots;
+
+    while (0 == (free_slots = _flat_match_free(&table->ctrl[group * L_CACHE_FLAT_GROUP]))) {
+        group = (group + ++step) & groups;
+    }
+    slot = group * L_CACHE_FLAT_GROUP + __builtin_ctz(free_slots);
+    if (table->ctrl[slot] == L_CACHE_FLAT_EMPTY) {
+        table->growth_left--;
+    }
+    table->ctrl[slot] = hash & 0x7f;
+    table->slots[slot].key = key;
+    table->slots[slot].item = item;
+    table->length++;
+}
+
+static void
+_flat_erase (LCacheFlatTable * table, uint64_t slot)
+{
+    uint8_t * group = &table->ctrl[slot & ~(uint64_t)(L_CACHE_FLAT_GROUP - 1)];
+
+    /* a group that was never full ends the probe sequences crossing it,
+     * its slot can be reused as EMPTY */
+    if (_flat_match(group, L_CACHE_FLAT_EMPTY)) {
+        table->ctrl[slot] = L_CACHE_FLAT_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[slot] = L_CACHE_FLAT_DELETED;
+    }
+    table->length--;
+}
+
+/**
+ * Moves the items of the next \e budget slots of the table being resized
+ * to the new one, and releases the old table once it is drained.
+ */
+static void
+_flat_migrate (LCacheP cache, uint64_t budget)
+{
+    LCacheFlatTable * old = &cache->flat.old;
+
+    while (budget-- > 0 && cache->flat.cursor <= old->mask) {
+        uint64_t slot = cache->flat.cursor++;
+
+        if (!(old->ctrl[slot] & 0x80)) {
+            LCacheFlatSlot * entry = &old->slots[slot];
+
+            _flat_place(&cache->flat.table, entry->key, entry->item, entry->item->hash);
+            _flat_erase(old, slot);
+        }
+    }
+    if (cache->flat.cursor > old->mask) {
+        _flat_free(old);
+    }
+}
+
+/**
+ * Replaces the full table of \e cache with a new one, twice as large
+ * unless it is mostly DELETED markers. The items move over the next
+ * operations, a few slots each.
+ */
+static bool
+_flat_resize (LCacheP cache)
+{
+    LCacheFlatTable * table = &cache->flat.table;
+    uint64_t slots = table->mask + 1;
+
+    if (cache->flat.old.ctrl) {
+        /* inserted faster than moved: finish the previous resize */
+        _flat_migrate(cache, cache->flat.old.mask + 1);
+        if (table->growth_left > 0) {
+            return true;
+        }
+    }
+    cache->flat.old = *table;
+    if (!_flat_alloc(table, (uint64_t)table->length * 16 < slots * 7 ? slots : slots * 2)) {
+        *table = cache->flat.old;
+        cache->flat.old.ctrl = NULL;
+        return false;
+    }
+    cache->flat.cursor = 0;
+    cache->flat.resizes++;
+    return true;
+}
+
+static LCacheItemP
+_flat_lookup (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    int64_t slot;
+
+    if (cache->flat.old.ctrl) {
+        _flat_migrate(cache, L_CACHE_FLAT_MIGRATE);
+    }
+    slot = _flat_find(cache, &cache->flat.table, key, hash);
+    if (slot >= 0) {
+        return cache->flat.table.slots[slot].item;
+    }
+    /* while resizing, the items not moved yet are still in the old table */
+    if (cache->flat.old.ctrl && (slot = _flat_find(cache, &cache->flat.old, key, hash)) >= 0) {
+        return cache->flat.old.slots[slot].item;
+    }
+    return NULL;
+}
+
+static bool
+_flat_insert (LCacheP cache, LCacheItemP item)
+{
+    if (cache->flat.old.ctrl) {
+        _flat_migrate(cache, L_CACHE_FLAT_MIGRATE);
+    }
+    if (0 == cache->flat.table.growth_left && !_flat_resize(cache)) {
+        return false;
+    }
+    _flat_place(&cache->flat.table, item->key, item, item->hash);
+    return true;
+}
+
+/**
+ * Keeps a removed item of \e cache for a later insertion.
+ */
+static void
+_flat_recycle (LCacheP cache, LCacheItemP item)
+{
+    if (cache->flat.spare_count >= L_CACHE_FLAT_SPARES) {
+        _item_free(item);
+        return;
+    }
+    _item_free_key(item);
+    item->chain = cache->flat.spares;
+    cache->flat.spares = item;
+    cache->flat.spare_count++;
+}
+
+static bool
+_flat_remove (LCacheP cache, LCacheItemP item)
+{
+    LCacheFlatTable * table = &cache->flat.table;
+    int64_t slot = _flat_find(cache, table, item->key, item->hash);
+
+    if (slot < 0 && cache->flat.old.ctrl) {
+        table = &cache->flat.old;
+        slot = _flat_find(cache, table, item->key, item->hash);
+    }
+    if (slot < 0) {
+        return false;
+    }
+    _flat_erase(table, slot);
+    _flat_recycle(cache, item);
+    return true;
+}
+
+static bool
+_flat_foreach (const LCacheFlatTable * table,
+               bool (*func) (lpointer key, lpointer value, lpointer user_data), lpointer user_data)
+{
+    uint64_t i;
+
+    for (i = 0; table->ctrl && i <= table->mask; i++) {
+        if (!(table->ctrl[i] & 0x80) && func(table->slots[i].key, table->slots[i].item, user_data)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+_flat_free_item (lpointer key, lpointer value, lpointer user_data)
+{
+    L_UNUSED_VAR (key);
+    L_UNUSED_VAR (user_data);
+    _item_free(value);
+    return false;
+}
+
+static void
+_flat_destroy (LCacheP cache)
+{
+    _flat_foreach(&cache->flat.table, _flat_free_item, NULL);
+    _flat_foreach(&cache->flat.old, _flat_free_item, NULL);
+    while (cache->flat.spares) {
+        LCacheItemP item = cache->flat.spares;
+        cache->flat.spares = item->chain;
+        _item_free(item);
+    }
+    _flat_free(&cache->flat.old);
+    _flat_free(&cache->flat.table);
+}
+
+/**
+ * Returns a zeroed item for \e cache, a recycled one when it has some.
+ */
+static LCacheItemP
+_item_new (LCacheP cache)
+{
+    LCacheItemP item = cache->flat.spares;
+
+    if (NULL == item) {
+        return cache->slab.enabled ? _slab_alloc(cache) : l_calloc (cache->item_size, 1);
+    }
+    cache->flat.spares = item->chain;
+    cache->flat.spare_count--;
+    memset(item, 0, sizeof (LCacheItem));
+    item->slabbed = cache->slab.enabled;
+    return item;
+}
+
+/* storage helpers: the LHash, the flat table or the lock-free buckets */
+
+/**
+ * Returns the item stored for \e key, of \e hash, or NULL.
+ */
+static LCacheItemP
+_storage_lookup (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    LCacheItemP item;
+
+    if (cache->flat.table.ctrl) {
+        return _flat_lookup(cache, key, hash);
+    }
+    if (NULL == cache->rcu.buckets) {
+        return l_hash_lookup(cache->storage, key);
+    }
+    item = __atomic_load_n(&cache->rcu.buckets[hash & cache->rcu.mask], __ATOMIC_ACQUIRE);
+    while (item && !_key_matches(cache, item->key, item, key, hash)) {
+        item = __atomic_load_n(&item->chain, __ATOMIC_ACQUIRE);
+    }
+    return item;
+}
+
+static bool
+_storage_insert (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP * bucket;
+
+    if (cache->flat.table.ctrl) {
+        return _flat_insert(cache, item);
+    }
+    if (NULL == cache->rcu.buckets) {
+        return l_hash_insert(cache->storage, item->key, item);
+    }
+    bucket = &cache->rcu.buckets[item->hash & cache->rcu.mask];
+    item->chain = *bucket;
+    /* publishes the initialized item to the readers */
+    __atomic_store_n(bucket, item, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Drops \e item from the storage, which releases it, at once or when the
+ * readers are done with it. Returns whether the item was stored.
+ */
+static bool
+_storage_remove (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP * link;
+
+    if (cache->flat.table.ctrl) {
+        return _flat_remove(cache, item);
+    }
+    if (NULL == cache->rcu.buckets) {
+        return l_hash_remove(cache->storage, item->key);
+    }
+    link = &cache->rcu.buckets[item->hash & cache->rcu.mask];
+    while (*link && *link != item) {
+        link = &(*link)->chain;
+    }
+    if (NULL == *link) {
+        return false;
+    }
+    /* readers standing on the item still find the rest of the chain */
+    __atomic_store_n(link, item->chain, __ATOMIC_RELEASE);
+    /* the epoch read must not pass the unlink: a reader entering a later
+     * epoch than the one read could still find the item */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    item->retired = __atomic_load_n(&_gReclaimEpoch, __ATOMIC_RELAXED);
+    item->retired_next = cache->rcu.limbo;
+    cache->rcu.limbo = item;
+    if (++cache->rcu.limbo_length >= cache->rcu.limbo_goal) {
+        _rcu_reclaim(cache);
+    }
+    return true;
+}
+
+static void
+_storage_foreach (LCacheP cache, bool (*func) (lpointer key, lpointer value, lpointer user_data),
+                  lpointer user_data)
+{
+    uint64_t i;
+    LCacheItemP item;
+
+    if (cache->flat.table.ctrl) {
+        if (!_flat_foreach(&cache->flat.table, func, user_data)) {
+            _flat_foreach(&cache->flat.old, func, user_data);
+        }
+        return;
+    }
+    if (NULL == cache->rcu.buckets) {
+        l_hash_foreach(cache->storage, func, user_data);
+        return;
+    }
+    for (i = 0; i <= cache->rcu.mask; i++) {
+        for (item = cache->rcu.buckets[i]; item; item = item->chain) {
+            if (func(item->key, item, user_data)) {
+                return;
+            }
+        }
+    }
+}
+
+static void _wheel_unlink (LCacheP cache, LCacheItemP item);
+
+/**
+ * Reads the monotonic system clock, in milliseconds.
+ */
+static uint64_t
+_clock_read (void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the time on the clock of \e cache, in milliseconds.
+ */
+static inline uint64_t
+_cache_now (LCacheP cache)
+{
+    if (__atomic_load_n(&cache->clock->ticking, __ATOMIC_RELAXED)) {
+        return __atomic_load_n(&cache->clock->now, __ATOMIC_RELAXED);
+    }
+    return _clock_read();
+}
+
+/**
+ * Invalidates the front cache copies of the values of \e cache, after one
+ * of them changed or left.
+ */
+static inline void
+_front_invalidate (LCacheP cache)
+{
+    if (cache->generation) {
+        __atomic_add_fetch(&cache->generation->value, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Drops \e item, already off the window and the replacement policy, from
+ * the timing wheel and the storage. The item itself is released by the
+ * storage value destroy function.
+ */
+static void
+_cache_drop_item (LCacheP cache, LCacheItemP item)
+{
+    if (item->timer_slot) {
+        _wheel_unlink(cache, item);
+    }
+    cache->weight -= item->weight;
+    if ( _storage_remove(cache, item) ) {
+        cache->length--;
+    }
+    _front_invalidate(cache);
+}
+
+/**
+ * Unlinks \e item from the replacement policy and drops it from the storage.
+ */
+static void
+_cache_remove_item (LCacheP cache, LCacheItemP item)
+{
+    if (item->windowed) {
+        _list_unlink(&cache->admission.window, item);
+    } else {
+        cache->policy->remove(cache, item);
+    }
+    _cache_drop_item(cache, item);
+}
+
+static int _plru_expire (LCacheP cache, int sets);
+
+/* expiration: a hierarchical timing wheel of one millisecond ticks. Each level
+ * has 64 slots covering 64 ticks of the level below; an item is filed
+ * under the tick its time-to-live elapses at, and moves down a level each
+ * time the wheel reaches its slot. An access only refreshes last_accessed:
+ * the deadline is checked again when the item comes due, and the item is
+ * filed anew if it was used meanwhile. Without a cleanup thread, lookups
+ * check the time-to-live themselves and insertions move the wheel a few
+ * items at a time */
+
+/**
+ * Returns the tick the time-to-live of \e item elapses at.
+ */
+static uint64_t
+_wheel_deadline (LCacheP cache, LCacheItemP item)
+{
+    uint64_t deadline = __atomic_load_n(&item->last_accessed, __ATOMIC_RELAXED) + item->ttl;
+
+    return deadline > cache->wheel.epoch ? deadline - cache->wheel.epoch : 0;
+}
+
+/**
+ * Allocates the wheel of \e cache for its first expiring item.
+ */
+static bool
+_wheel_init (LCacheP cache)
+{
+    cache->wheel.slots = l_calloc (sizeof (LCacheItemP), L_CACHE_WHEEL_LEVELS * L_CACHE_WHEEL_SLOTS);
+    if (NULL == cache->wheel.slots) {
+        return false;
+    }
+    cache->wheel.epoch = _cache_now(cache);
+    cache->wheel.level = -1;
+    return true;
+}
+
+static void
+_wheel_schedule (LCacheP cache, LCacheItemP item, uint64_t expires)
+{
+    uint64_t now = cache->wheel.now;
+    uint64_t span = (1u << (L_CACHE_WHEEL_LEVELS * L_CACHE_WHEEL_BITS)) - 1;
+    LCacheItemP * head;
+    int level;
+
+    if (expires <= now) {
+        expires = now + 1;
+    }
+    if ((expires ^ now) > span) {
+        /* past the current turn of the top level: checked again at its end */
+        expires = (now | span) != now ? (now | span) : now + 1;
+    }
+    /* the highest digit told apart from now: the slot is always ahead */
+    level = (63 - __builtin_clzll((expires ^ now) & span)) / L_CACHE_WHEEL_BITS;
+    item->expires = expires;
+    item->timer_slot = level * L_CACHE_WHEEL_SLOTS +
+                       ((expires >> (level * L_CACHE_WHEEL_BITS)) & (L_CACHE_WHEEL_SLOTS - 1));
+    head = &cache->wheel.slots[item->timer_slot];
+    item->timer_prev = NULL;
+    item->timer_next = *head;
+    if (*head) {
+        (*head)->timer_prev = item;
+    }
+    *head = item;
+    cache->wheel.occupied[level] |= 1ULL << (item->timer_slot & (L_CACHE_WHEEL_SLOTS - 1));
+    item->timer_slot++;
+}
+
+static void
+_wheel_unlink (LCacheP cache, LCacheItemP item)
+{
+    int slot = item->timer_slot - 1;
+
+    if (item->timer_prev) {
+        item->timer_prev->timer_next = item->timer_next;
+    } else if (NULL == (cache->wheel.slots[slot] = item->timer_next)) {
+        cache->wheel.occupied[slot / L_CACHE_WHEEL_SLOTS] &=
+            ~(1ULL << (slot & (L_CACHE_WHEEL_SLOTS - 1)));
+    }
+    if (item->timer_next) {
+        item->timer_next->timer_prev = item->timer_prev;
+    }
+    item->timer_slot = 0;
+}
+
+/**
+ * Returns the first tick after the current one reaching a non-empty slot,
+ * or \e tick if it comes first.
+ */
+static uint64_t
+_wheel_next (LCacheP cache, uint64_t tick)
+{
+    uint64_t now = cache->wheel.now;
+    uint64_t next = tick;
+    int level;
+
+    for (level = 0; level < L_CACHE_WHEEL_LEVELS; level++) {
+        int shift = level * L_CACHE_WHEEL_BITS;
+        int digit = (now >> shift) & (L_CACHE_WHEEL_SLOTS - 1);
+        uint64_t turn = now >> (shift + L_CACHE_WHEEL_BITS);
+        uint64_t ahead = cache->wheel.occupied[level] & (~1ULL << digit);
+        uint64_t reached;
+
+        if (0 == ahead) {
+            /* the top level also holds the first slot of its next turn */
+            if (level < L_CACHE_WHEEL_LEVELS - 1 || 0 == cache->wheel.occupied[level]) {
+                continue;
+            }
+            ahead = cache->wheel.occupied[level];
+            turn++;
+        }
+        reached = (turn << (shift + L_CACHE_WHEEL_BITS)) |
+                  ((uint64_t)__builtin_ctzll(ahead) << shift);
+        if (reached < next) {
+            next = reached;
+        }
+    }
+    return next;
+}
+
+/**
+ * Moves the wheel forward to \e tick, expiring the due items of the slots
+ * it reaches and filing the others again. Stops once \e budget items were
+ * handled, to resume from there on the next call; a negative budget is
+ * unlimited.
+ *
+ * @returns the number of expired items.
+ */
+static int
+_wheel_advance (LCacheP cache, uint64_t tick, int budget)
+{
+    LCacheItemP item;
+    int expired = 0;
+
+    for (;;) {
+        uint64_t now = cache->wheel.now;
+
+        for (; cache->wheel.level >= 0; cache->wheel.level--) {
+            int level = cache->wheel.level;
+            int slot = level * L_CACHE_WHEEL_SLOTS +
+                       ((now >> (level * L_CACHE_WHEEL_BITS)) & (L_CACHE_WHEEL_SLOTS - 1));
+
+            /* an upper slot is reached when the digits below it wrap */
+            if (now & ((1u << (level * L_CACHE_WHEEL_BITS)) - 1)) {
+                continue;
+            }
+            while (NULL != (item = cache->wheel.slots[slot])) {
+                uint64_t deadline;
+
+                if (budget-- == 0) {
+                    return expired;
+                }
+                _wheel_unlink(cache, item);
+                deadline = _wheel_deadline(cache, item);
+                if (deadline > now) {
+                    _wheel_schedule(cache, item, deadline);
+                    continue;
+                }
+                _cache_remove_item(cache, item);
+                expired++;
+            }
+        }
+        if (now >= tick) {
+            return expired;
+        }
+        cache->wheel.now = _wheel_next(cache, tick);
+        cache->wheel.level = L_CACHE_WHEEL_LEVELS - 1;
+    }
+}
+
+/**
+ * Returns whether the time-to-live of \e item elapsed.
+ */
+static bool
+_cache_item_expired (LCacheP cache, LCacheItemP item)
+{
+    uint32_t ttl = __atomic_load_n(&item->ttl, __ATOMIC_RELAXED);
+
+    return ttl > 0 &&
+           (int64_t)(_cache_now(cache) - __atomic_load_n(&item->last_accessed, __ATOMIC_RELAXED)) >= ttl;
+}
+
+static void
+_cache_expire (LCacheP cache)
+{
+    if (cache->plru.sets && cache->object_ttl > 0) {
+        cache->expirations += _plru_expire(cache, cache->plru.set_count);
+    } else if (cache->wheel.slots) {
+        cache->expirations += _wheel_advance(cache, _cache_now(cache) - cache->wheel.epoch, -1);
+    }
+}
+
+/**
+ * Runs a bounded share of the expiration work on behalf of an insertion,
+ * timed for the statistics.
+ */
+static void
+_cache_expire_step (LCacheP cache)
+{
+    struct timespec start, end;
+    double elapsed;
+
+    if ((NULL == cache->plru.sets || cache->object_ttl <= 0) && NULL == cache->wheel.slots) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (cache->plru.sets) {
+        cache->expirations += _plru_expire(cache, cache->expire_batch);
+    } else {
+        cache->expirations += _wheel_advance(cache, _cache_now(cache) - cache->wheel.epoch,
+                                             cache->expire_batch);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    if (elapsed > cache->expire_time_max) {
+        cache->expire_time_max = elapsed;
+    }
+}
+
+/**
+ * Drops the expired items and lets the policy age its statistics.
+ */
+static void
+_cache_sweep (LCacheP cache)
+{
+    _cache_expire(cache);
+    if (cache->policy->age) {
+        cache->policy->age(cache);
+    }
+    if (cache->rcu.limbo) {
+        _rcu_reclaim(cache);
+    }
+}
+
+static void *
+_cache_checker_thread(void *data)
+{
+    LCacheP cache = data;
+    LCacheClock * clock = cache->clock;
+    struct timespec deadline;
+    uint64_t now = _clock_read();
+    uint64_t sweep = cache->cleanup_delay > 0 ? now + cache->cleanup_delay * 1000ULL : 0;
+    uint64_t next;
+    int i;
+
+    // setPriority(Thread.MIN_PRIORITY);
+    pthread_mutex_lock(&cache->cleaner.lock);
+    while (!cache->cleaner.stopping) {
+        // cleanup_delay, or the next clock update when sooner
+        next = clock->ticking ? now + clock->resolution : sweep;
+        if (sweep && sweep < next) {
+            next = sweep;
+        }
+        deadline.tv_sec = next / 1000;
+        deadline.tv_nsec = next % 1000 * 1000000;
+        while (!cache->cleaner.stopping &&
+               pthread_cond_timedwait(&cache->cleaner.wake, &cache->cleaner.lock,
+                                      &deadline) != ETIMEDOUT)
+            ;
+        if (cache->cleaner.stopping) {
+            break;
+        }
+        now = _clock_read();
+        if (clock->ticking) {
+            __atomic_store_n(&clock->now, now, __ATOMIC_RELAXED);
+        }
+        if (0 == sweep || now < sweep) {
+            continue;
+        }
+        sweep = now + cache->cleanup_delay * 1000ULL;
+        pthread_mutex_unlock(&cache->cleaner.lock);
+
+        for (i = 0; i < (1 << cache->shard_bits); i++) {
+            pthread_mutex_lock(&cache->shards[i]->lock);
+            _cache_sweep(cache->shards[i]);
+            pthread_mutex_unlock(&cache->shards[i]->lock);
+        }
+        pthread_mutex_lock(&cache->cleaner.lock);
+    }
+    pthread_mutex_unlock(&cache->cleaner.lock);
+    return NULL;
+}
+
+/**
+ * Starts the timer thread of \e cache, sweeping every cleanup_delay
+ * seconds and keeping the clock of the cache until _cleaner_stop().
+ */
+static bool
+_cleaner_start (LCacheP cache)
+{
+    pthread_condattr_t attr;
+    int rc;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&cache->cleaner.lock, NULL);
+    pthread_cond_init(&cache->cleaner.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (cache->clock->resolution > 0) {
+        cache->clock->now = _clock_read();
+        __atomic_store_n(&cache->clock->ticking, true, __ATOMIC_RELEASE);
+    }
+    rc = pthread_create(&cache->lru_tid, NULL, _cache_checker_thread, cache);
+    if (rc) {
+        __atomic_store_n(&cache->clock->ticking, false, __ATOMIC_RELAXED);
+        pthread_cond_destroy(&cache->cleaner.wake);
+        pthread_mutex_destroy(&cache->cleaner.lock);
+        return false;
+    }
+    cache->cleaner.running = true;
+    return true;
+}
+
+/**
+ * Wakes the cleanup thread of \e cache and waits for it to return; a
+ * sweep in progress completes first.
+ */
+static void
+_cleaner_stop (LCacheP cache)
+{
+    if (!cache->cleaner.running) {
+        return;
+    }
+    pthread_mutex_lock(&cache->cleaner.lock);
+    cache->cleaner.stopping = true;
+    pthread_cond_signal(&cache->cleaner.wake);
+    pthread_mutex_unlock(&cache->cleaner.lock);
+    pthread_join(cache->lru_tid, NULL);
+    __atomic_store_n(&cache->clock->ticking, false, __ATOMIC_RELAXED);
+
+    pthread_cond_destroy(&cache->cleaner.wake);
+    pthread_mutex_destroy(&cache->cleaner.lock);
+    cache->cleaner.running = false;
+}
+
+static void
+del_value (lpointer data)
+{
+    _item_free(data);
+    data = NULL;
+}
+
+/* hash index helpers */
+
+static bool
+_index_init (LCacheHashIndex * index, int entries)
+{
+    int size = 2;
+
+    while (size < 2 * entries) {
+        size <<= 1;
+    }
+    index->slots = l_calloc (sizeof (LCacheHashSlot), size);
+    index->mask = size - 1;
+    return NULL != index->slots;
+}
+
+static void
+_index_destroy (LCacheHashIndex * index)
+{
+    l_free(index->slots);
+    index->slots = NULL;
+}
+
+static size_t
+_index_bytes (const LCacheHashIndex * index)
+{
+    return index->slots ? (index->mask + 1) * sizeof (LCacheHashSlot) : 0;
+}
+
+/**
+ * Returns the node stored for \e hash, or -1.
+ */
+static int
+_index_find (const LCacheHashIndex * index, uint64_t hash)
+{
+    int slot = hash & index->mask;
+    while (index->slots[slot].node) {
+        if (index->slots[slot].hash == hash) {
+            return index->slots[slot].node - 1;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return -1;
+}
+
+static void
+_index_insert (LCacheHashIndex * index, uint64_t hash, int node)
+{
+    int slot = hash & index->mask;
+    while (index->slots[slot].node) {
+        slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot].hash = hash;
+    index->slots[slot].node = node + 1;
+}
+
+static void
+_index_remove (LCacheHashIndex * index, uint64_t hash, int node)
+{
+    int hole = hash & index->mask;
+    int slot;
+
+    while (index->slots[hole].node != node + 1) {
+        hole = (hole + 1) & index->mask;
+    }
+    /* backward shift deletion keeps the linear probe chains intact */
+    for (slot = hole;;) {
+        int home;
+        slot = (slot + 1) & index->mask;
+        if (0 == index->slots[slot].node) {
+            break;
+        }
+        home = index->slots[slot].hash & index->mask;
+        if (((slot - home) & index->mask) >= ((slot - hole) & index->mask)) {
+            index->slots[hole] = index->slots[slot];
+            hole = slot;
+        }
+    }
+    index->slots[hole].node = 0;
+}
+
+/* ghost list helpers */
+
+static bool
+_ghosts_init (LCacheGhosts * ghosts, int capacity)
+{
+    int i;
+
+    ghosts->nodes = l_calloc (sizeof (LCacheGhost), capacity);
+    if (NULL == ghosts->nodes || !_index_init(&ghosts->index, capacity)) {
+        l_free(ghosts->nodes);
+        ghosts->nodes = NULL;
+        return false;
+    }
+    ghosts->capacity = capacity;
+    for (i = 0; i < capacity; i++) {
+        ghosts->nodes[i].list = -1;
+        ghosts->nodes[i].next = i + 1 < capacity ? i + 1 : -1;
+    }
+    ghosts->free = capacity > 0 ? 0 : -1;
+    for (i = 0; i < 2; i++) {
+        ghosts->lists[i].head = ghosts->lists[i].tail = -1;
+        ghosts->lists[i].length = 0;
+    }
+    return true;
+}
+
+static void
+_ghosts_destroy (LCacheGhosts * ghosts)
+{
+    l_free(ghosts->nodes);
+    ghosts->nodes = NULL;
+    _index_destroy(&ghosts->index);
+}
+
+static size_t
+_ghosts_bytes (const LCacheGhosts * ghosts)
+{
+    if (NULL == ghosts->nodes) {
+        return 0;
+    }
+    return ghosts->capacity * sizeof (LCacheGhost) + _index_bytes(&ghosts->index);
+}
+
+/**
+ * Returns the ghost entry remembering \e hash, or -1.
+ */
+static int
+_ghosts_find (const LCacheGhosts * ghosts, uint64_t hash)
+{
+    return _index_find(&ghosts->index, hash);
+}
+
+static void
+_ghosts_remove (LCacheGhosts * ghosts, int node)
+{
+    LCacheGhost * g = &ghosts->nodes[node];
+    LCacheGhostList * list = &ghosts->lists[g->list];
+
+    _index_remove(&ghosts->index, g->hash, node);
+    if (g->prev >= 0) {
+        ghosts->nodes[g->prev].next = g->next;
+    } else {
+        list->head = g->next;
+    }
+    if (g->next >= 0) {
+        ghosts->nodes[g->next].prev = g->prev;
+    } else {
+        list->tail = g->prev;
+    }
+    list->length--;
+    g->list = -1;
+    g->next = ghosts->free;
+    ghosts->free = node;
+}
+
+static void
+_ghosts_pop_lru (LCacheGhosts * ghosts, int list)
+{
+    if (ghosts->lists[list].tail >= 0) {
+        _ghosts_remove(ghosts, ghosts->lists[list].tail);
+    }
+}
+
+/**
+ * Remembers \e hash at the most recently evicted end of ghost \e list.
+ */
+static void
+_ghosts_push (LCacheGhosts * ghosts, int list, uint64_t hash)
+{
+    int node = _ghosts_find(ghosts, hash);
+    LCacheGhost * g;
+
+    if (node >= 0) {
+        _ghosts_remove(ghosts, node);
+    }
+    if (ghosts->free < 0) {
+        /* the policies keep the ghosts within bounds, this is a safety net */
+        _ghosts_pop_lru(ghosts, ghosts->lists[0].length >= ghosts->lists[1].length ? 0 : 1);
+    }
+    if (ghosts->free < 0) {
+        return;
+    }
+    node = ghosts->free;
+    g = &ghosts->nodes[node];
+    ghosts->free = g->next;
+
+    g->hash = hash;
+    g->list = list;
+    g->prev = -1;
+    g->next = ghosts->lists[list].head;
+    if (g->next >= 0) {
+        ghosts->nodes[g->next].prev = node;
+    } else {
+        ghosts->lists[list].tail = node;
+    }
+    ghosts->lists[list].head = node;
+    ghosts->lists[list].length++;
+    _index_insert(&ghosts->index, hash, node);
+}
+
+/* L_CACHE_LRU / L_CACHE_MRU: a single recency list, most recent at the head */
+
+static void
+_lru_insert (LCacheP cache, LCacheItemP item)
+{
+    _list_push_head(&cache->recency, item);
+}
+
+static void
+_lru_hit (LCacheP cache, LCacheItemP item)
+{
+    _list_move_to_head(&cache->recency, item);
+}
+
+static void
+_lru_remove (LCacheP cache, LCacheItemP item)
+{
+    _list_unlink(&cache->recency, item);
+}
+
+static LCacheItemP
+_lru_victim (LCacheP cache, LCacheItemP incoming)
+{
+    L_UNUSED_VAR(incoming);
+    return cache->recency.tail;
+}
+
+static LCacheItemP
+_mru_victim (LCacheP cache, LCacheItemP incoming)
+{
+    L_UNUSED_VAR(incoming);
+    return cache->recency.head;
+}
+
+static const LCachePolicy _lru_policy = {
+    _lru_insert, _lru_hit, _lru_remove, _lru_victim, NULL, NULL, NULL, NULL
+};
+
+static const LCachePolicy _mru_policy = {
+    _lru_insert, _lru_hit, _lru_remove, _mru_victim, NULL, NULL, NULL, NULL
+};
+
+/* L_CACHE_RR and sampled L_CACHE_LRU: the items sit in a dense array and a
+ * hit only refreshes last_accessed; the victim is a random item, or the
+ * oldest of a few random samples merged into a small pool of candidates */
+
+static uint64_t
+_xorshift (uint64_t * seed)
+{
+    uint64_t x = *seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 2685821657736338717ULL;
+}
+
+static uint32_t
+_sampled_random (LCacheP cache)
+{
+    return (uint32_t)(_xorshift(&cache->sampled.seed) >> 32);
+}
+
+static LCacheItemP
+_sampled_pick (LCacheP cache)
+{
+    return cache->sampled.items[((uint64_t)_sampled_random(cache) * cache->sampled.length) >> 32];
+}
+
+static void
+_sampled_insert (LCacheP cache, LCacheItemP item)
+{
+    item->node = cache->sampled.length++;
+    item->segment = L_CACHE_SAMPLED_RESIDENT;
+    cache->sampled.items[item->node] = item;
+}
+
+static void
+_sampled_hit (LCacheP cache, LCacheItemP item)
+{
+    L_UNUSED_VAR(cache);
+    L_UNUSED_VAR(item);
+}
+
+static void
+_sampled_remove (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP last = cache->sampled.items[--cache->sampled.length];
+    int i;
+
+    last->node = item->node;
+    cache->sampled.items[item->node] = last;
+    if (item->segment == L_CACHE_SAMPLED_POOLED) {
+        for (i = 0; cache->sampled.pool[i].item != item; i++)
+            ;
+        memmove(&cache->sampled.pool[i], &cache->sampled.pool[i + 1],
+                (--cache->sampled.pool_length - i) * sizeof (LCacheCandidate));
+    }
+}
+
+/**
+ * Ranks \e item in the eviction pool, dropping the most recently used
+ * candidate when the pool is full.
+ */
+static void
+_sampled_offer (LCacheP cache, LCacheItemP item)
+{
+    LCacheCandidate * pool = cache->sampled.pool;
+    uint64_t last_accessed = __atomic_load_n(&item->last_accessed, __ATOMIC_RELAXED);
+    int i;
+
+    if (item->segment == L_CACHE_SAMPLED_POOLED) {
+        return;
+    }
+    if (cache->sampled.pool_length == L_CACHE_EVICTION_POOL) {
+        if (last_accessed >= pool[0].last_accessed) {
+            return;
+        }
+        pool[0].item->segment = L_CACHE_SAMPLED_RESIDENT;
+        memmove(&pool[0], &pool[1], --cache->sampled.pool_length * sizeof (LCacheCandidate));
+    }
+    for (i = 0; i < cache->sampled.pool_length && pool[i].last_accessed >= last_accessed; i++)
+        ;
+    memmove(&pool[i + 1], &pool[i], (cache->sampled.pool_length - i) * sizeof (LCacheCandidate));
+    pool[i].item = item;
+    pool[i].last_accessed = last_accessed;
+    item->segment = L_CACHE_SAMPLED_POOLED;
+    cache->sampled.pool_length++;
+}
+
+static LCacheItemP
+_sampled_victim (LCacheP cache, LCacheItemP incoming)
+{
+    int i;
+
+    L_UNUSED_VAR(incoming);
+    if (0 == cache->sampled.samples) {
+        return _sampled_pick(cache);
+    }
+    for (i = 0; i < cache->sampled.samples; i++) {
+        _sampled_offer(cache, _sampled_pick(cache));
+    }
+    while (cache->sampled.pool_length > 0) {
+        LCacheCandidate * candidate = &cache->sampled.pool[--cache->sampled.pool_length];
+
+        candidate->item->segment = L_CACHE_SAMPLED_RESIDENT;
+        /* skip the candidates used again since they were ranked */
+        if (__atomic_load_n(&candidate->item->last_accessed, __ATOMIC_RELAXED) ==
+            candidate->last_accessed) {
+            return candidate->item;
+        }
+    }
+    return _sampled_pick(cache);
+}
+
+static bool
+_sampled_init (LCacheP cache)
+{
+    cache->sampled.items = l_calloc (sizeof (LCacheItemP), cache->capacity);
+    if (NULL == cache->sampled.items) {
+        return false;
+    }
+    cache->sampled.seed = _cache_key_hash(cache) ^ (uint64_t)time(NULL);
+    if (0 == cache->sampled.seed) {
+        cache->sampled.seed = 1;
+    }
+    return true;
+}
+
+static void
+_sampled_destroy (LCacheP cache)
+{
+    l_free(cache->sampled.items);
+    cache->sampled.items = NULL;
+}
+
+static const LCachePolicy _sampled_policy = {
+    _sampled_insert, _sampled_hit, _sampled_remove, _sampled_victim,
+    _sampled_init, _sampled_destroy, NULL, NULL
+};
+
+/* L_CACHE_SLRU: misses enter the probationary segment, hits move to the protected one */
+
+static void
+_slru_insert (LCacheP cache, LCacheItemP item)
+{
+    item->segment = L_CACHE_SEGMENT_PROBATION;
+    _list_push_head(&cache->slru.probation, item);
+}
+
+static void
+_slru_hit (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP demoted;
+
+    if (item->segment == L_CACHE_SEGMENT_PROTECTED) {
+        _list_move_to_head(&cache->slru.protect, item);
+        return;
+    }
+    _list_unlink(&cache->slru.probation, item);
+    item->segment = L_CACHE_SEGMENT_PROTECTED;
+    _list_push_head(&cache->slru.protect, item);
+
+    /* an overflowing protected segment gives its oldest item a second chance */
+    if (cache->capacity > 0 &&
+        cache->slru.protect.length > cache->slru.protected_capacity) {
+        demoted = cache->slru.protect.tail;
+        _list_unlink(&cache->slru.protect, demoted);
+        demoted->segment = L_CACHE_SEGMENT_PROBATION;
+        _list_push_head(&cache->slru.probation, demoted);
+    }
+}
+
+static void
+_slru_remove (LCacheP cache, LCacheItemP item)
+{
+    if (item->segment == L_CACHE_SEGMENT_PROTECTED) {
+        _list_unlink(&cache->slru.protect, item);
+    } else {
+        _list_unlink(&cache->slru.probation, item);
+    }
+}
+
+static LCacheItemP
+_slru_victim (LCacheP cache, LCacheItemP incoming)
+{
+    L_UNUSED_VAR(incoming);
+    if (cache->slru.probation.tail) {
+        return cache->slru.probation.tail;
+    }
+    return cache->slru.protect.tail;
+}
+
+static const LCachePolicy _slru_policy = {
+    _slru_insert, _slru_hit, _slru_remove, _slru_victim, NULL, NULL, NULL, NULL
+};
+
+/* L_CACHE_ARC: T1/T2 resident lists, B1/B2 ghost lists and adaptive target p */
+
+/**
+ * Looks \e item up in the ghost lists and adapts the target size of T1:
+ * a hit in B1 means T1 was too small, a hit in B2 means T2 was.
+ */
+static void
+_arc_classify (LCacheP cache, LCacheItemP item)
+{
+    LCacheGhosts * ghosts = &cache->arc.ghosts;
+    int b1 = ghosts->lists[L_CACHE_GHOST_B1].length;
+    int b2 = ghosts->lists[L_CACHE_GHOST_B2].length;
+    int node = _ghosts_find(ghosts, item->hash);
+    int delta;
+
+    cache->arc.pending = item;
+    cache->arc.pending_ghost = -1;
+    if (node < 0) {
+        return;
+    }
+    cache->arc.pending_ghost = ghosts->nodes[node].list;
+    if (cache->arc.pending_ghost == L_CACHE_GHOST_B1) {
+        delta = b2 > b1 ? b2 / b1 : 1;
+        cache->arc.p += delta;
+        if (cache->arc.p > cache->capacity) {
+            cache->arc.p = cache->capacity;
+        }
+    } else {
+        delta = b1 > b2 ? b1 / b2 : 1;
+        cache->arc.p -= delta;
+        if (cache->arc.p < 0) {
+            cache->arc.p = 0;
+        }
+    }
+    _ghosts_remove(ghosts, node);
+}
+
+/**
+ * Keeps |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c before a new
+ * key, unknown to the ghosts, enters T1.
+ */
+static void
+_arc_trim_ghosts (LCacheP cache)
+{
+    LCacheGhosts * ghosts = &cache->arc.ghosts;
+    int c = cache->capacity;
+    int b1 = ghosts->lists[L_CACHE_GHOST_B1].length;
+    int b2 = ghosts->lists[L_CACHE_GHOST_B2].length;
+
+    if (cache->arc.t1.length + b1 >= c) {
+        _ghosts_pop_lru(ghosts, L_CACHE_GHOST_B1);
+    } else if (cache->arc.t1.length + cache->arc.t2.length + b1 + b2 >= 2 * c) {
+        _ghosts_pop_lru(ghosts, L_CACHE_GHOST_B2);
+    }
+}
+
+static void
+_arc_insert (LCacheP cache, LCacheItemP item)
+{
+    if (cache->arc.pending != item) {
+        _arc_classify(cache, item);
+        if (cache->arc.pending_ghost < 0) {
+            _arc_trim_ghosts(cache);
+        }
+    }
+    if (cache->arc.pending_ghost < 0) {
+        item->segment = L_CACHE_SEGMENT_T1;
+        _list_push_head(&cache->arc.t1, item);
+    } else {
+        item->segment = L_CACHE_SEGMENT_T2;
+        _list_push_head(&cache->arc.t2, item);
+    }
+    cache->arc.pending = NULL;
+}
+
+static void
+_arc_hit (LCacheP cache, LCacheItemP item)
+{
+    if (item->segment == L_CACHE_SEGMENT_T1) {
+        _list_unlink(&cache->arc.t1, item);
+        item->segment = L_CACHE_SEGMENT_T2;
+        _list_push_head(&cache->arc.t2, item);
+    } else {
+        _list_move_to_head(&cache->arc.t2, item);
+    }
+}
+
+static void
+_arc_remove (LCacheP cache, LCacheItemP item)
+{
+    if (item->segment == L_CACHE_SEGMENT_T1) {
+        _list_unlink(&cache->arc.t1, item);
+    } else {
+        _list_unlink(&cache->arc.t2, item);
+    }
+}
+
+/**
+ * The ARC REPLACE routine: evicts from T1 while it exceeds its target p,
+ * from T2 otherwise, and remembers the victim in the matching ghost list.
+ */
+static LCacheItemP
+_arc_victim (LCacheP cache, LCacheItemP incoming)
+{
+    LCacheItemP victim;
+    int t1 = cache->arc.t1.length;
+
+    _arc_classify(cache, incoming);
+    if (cache->arc.pending_ghost < 0) {
+        if (t1 >= cache->capacity) {
+            /* T1 fills the whole cache: drop its LRU page without a ghost */
+            return cache->arc.t1.tail;
+        }
+        _arc_trim_ghosts(cache);
+    }
+
+    if (t1 > 0 && (t1 > cache->arc.p ||
+                   (cache->arc.pending_ghost == L_CACHE_GHOST_B2 && t1 == cache->arc.p))) {
+        victim = cache->arc.t1.tail;
+        _ghosts_push(&cache->arc.ghosts, L_CACHE_GHOST_B1, victim->hash);
+    } else if (cache->arc.t2.tail) {
+        victim = cache->arc.t2.tail;
+        _ghosts_push(&cache->arc.ghosts, L_CACHE_GHOST_B2, victim->hash);
+    } else {
+        victim = cache->arc.t1.tail;
+        if (victim) {
+            _ghosts_push(&cache->arc.ghosts, L_CACHE_GHOST_B1, victim->hash);
+        }
+    }
+    return victim;
+}
+
+static bool
+_arc_init (LCacheP cache)
+{
+    cache->arc.pending_ghost = -1;
+    return _ghosts_init(&cache->arc.ghosts, cache->capacity);
+}
+
+static void
+_arc_destroy (LCacheP cache)
+{
+    _ghosts_destroy(&cache->arc.ghosts);
+}
+
+static const LCachePolicy _arc_policy = {
+    _arc_insert, _arc_hit, _arc_remove, _arc_victim, _arc_init, _arc_destroy, NULL, NULL
+};
+
+/* L_CACHE_CAR: ARC adaptation over two CLOCKs. A hit only sets the item
+ * reference bit; the hands, kept at the list tails, move on eviction. */
+
+static void
+_car_hit (LCacheP cache, LCacheItemP item)
+{
+    L_UNUSED_VAR(cache);
+    if (!__atomic_load_n(&item->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&item->referenced, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+_car_classify (LCacheP cache, LCacheItemP item)
+{
+    int node = _ghosts_find(&cache->arc.ghosts, item->hash);
+
+    cache->arc.pending = item;
+    cache->arc.pending_ghost = node < 0 ? -1 : cache->arc.ghosts.nodes[node].list;
+}
+
+/**
+ * Discards ghosts so that |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+ * once a key unknown to the ghosts enters T1. \e t1 and \e resident are the
+ * occupancies left after the pending eviction.
+ */
+static void
+_car_trim_ghosts (LCacheP cache, int t1, int resident)
+{
+    LCacheGhosts * ghosts = &cache->arc.ghosts;
+    int b1 = ghosts->lists[L_CACHE_GHOST_B1].length;
+    int b2 = ghosts->lists[L_CACHE_GHOST_B2].length;
+
+    if (t1 + b1 >= cache->capacity) {
+        _ghosts_pop_lru(ghosts, L_CACHE_GHOST_B1);
+    } else if (resident + b1 + b2 >= 2 * cache->capacity) {
+        _ghosts_pop_lru(ghosts, L_CACHE_GHOST_B2);
+    }
+}
+
+static void
+_car_insert (LCacheP cache, LCacheItemP item)
+{
+    LCacheGhosts * ghosts = &cache->arc.ghosts;
+    int b1 = ghosts->lists[L_CACHE_GHOST_B1].length;
+    int b2 = ghosts->lists[L_CACHE_GHOST_B2].length;
+    int node;
+
+    if (cache->arc.pending != item) {
+        _car_classify(cache, item);
+        if (cache->arc.pending_ghost < 0) {
+            _car_trim_ghosts(cache, cache->arc.t1.length,
+                             cache->arc.t1.length + cache->arc.t2.length);
+        }
+    }
+    __atomic_store_n(&item->referenced, 0, __ATOMIC_RELAXED);
+    node = cache->arc.pending_ghost < 0 ? -1 : _ghosts_find(ghosts, item->hash);
+    if (node < 0) {
+        item->segment = L_CACHE_SEGMENT_T1;
+        _list_push_head(&cache->arc.t1, item);
+    } else {
+        if (cache->arc.pending_ghost == L_CACHE_GHOST_B1) {
+            cache->arc.p += b2 > b1 ? b2 / b1 : 1;
+            if (cache->arc.p > cache->capacity) {
+                cache->arc.p = cache->capacity;
+            }
+        } else {
+            cache->arc.p -= b1 > b2 ? b1 / b2 : 1;
+            if (cache->arc.p < 0) {
+                cache->arc.p = 0;
+            }
+        }
+        _ghosts_remove(ghosts, node);
+        item->segment = L_CACHE_SEGMENT_T2;
+        _list_push_head(&cache->arc.t2, item);
+    }
+    cache->arc.pending = NULL;
+}
+
+/**
+ * The CAR replace routine: sweeps the T1 clock while T1 exceeds its target,
+ * the T2 clock otherwise. Referenced items get a second chance, T1 ones by
+ * moving to T2, and the first unreferenced one is evicted into its ghost list.
+ */
+static LCacheItemP
+_car_victim (LCacheP cache, LCacheItemP incoming)
+{
+    LCacheItemP hand;
+    int sweeps = 2 * cache->length + 2;
+
+    _car_classify(cache, incoming);
+    for (;;) {
+        bool last = --sweeps <= 0;     /* bounds the sweep against concurrent hits */
+
+        if (cache->arc.t1.length > 0 &&
+            cache->arc.t1.length >= (cache->arc.p > 1 ? cache->arc.p : 1)) {
+            hand = cache->arc.t1.tail;
+            if (last || !__atomic_load_n(&hand->referenced, __ATOMIC_RELAXED)) {
+                _ghosts_push(&cache->arc.ghosts, L_CACHE_GHOST_B1, hand->hash);
+                break;
+            }
+            __atomic_store_n(&hand->referenced, 0, __ATOMIC_RELAXED);
+            _list_unlink(&cache->arc.t1, hand);
+            hand->segment = L_CACHE_SEGMENT_T2;
+            _list_push_head(&cache->arc.t2, hand);
+        } else if (cache->arc.t2.length > 0) {
+            hand = cache->arc.t2.tail;
+            if (last || !__atomic_load_n(&hand->referenced, __ATOMIC_RELAXED)) {
+                _ghosts_push(&cache->arc.ghosts, L_CACHE_GHOST_B2, hand->hash);
+                break;
+            }
+            __atomic_store_n(&hand->referenced, 0, __ATOMIC_RELAXED);
+            _list_move_to_head(&cache->arc.t2, hand);
+        } else {
+            return cache->arc.t1.tail;
+        }
+    }
+
+    if (cache->arc.pending_ghost < 0) {
+        _car_trim_ghosts(cache,
+                         cache->arc.t1.length - (hand->segment == L_CACHE_SEGMENT_T1),
+                         cache->arc.t1.length + cache->arc.t2.length - 1);
+    }
+    return hand;
+}
+
+static const LCachePolicy _car_policy = {
+    _car_insert, _car_hit, _arc_remove, _car_victim, _arc_init, _arc_destroy, NULL, NULL
+};
+
+/* L_CACHE_LIRS: LIR blocks and recently referenced blocks in the stack S,
+ * resident HIR blocks in the queue Q, evictions from the front of Q */
+
+static void
+_lirs_s_unlink (LCacheP cache, int node)
+{
+    LCacheLirsNode * nodes = cache->lirs.nodes;
+    LCacheLirsNode * n = &nodes[node];
+
+    if (n->sprev >= 0) {
+        nodes[n->sprev].snext = n->snext;
+    } else {
+        cache->lirs.s.head = n->snext;
+    }
+    if (n->snext >= 0) {
+        nodes[n->snext].sprev = n->sprev;
+    } else {
+        cache->lirs.s.tail = n->sprev;
+    }
+    n->in_s = 0;
+    cache->lirs.s.length--;
+}
+
+static void
+_lirs_s_push (LCacheP cache, int node)
+{
+    LCacheLirsNode * nodes = cache->lirs.nodes;
+    LCacheLirsNode * n = &nodes[node];
+
+    if (n->in_s) {
+        if (cache->lirs.s.head == node) {
+            return;
+        }
+        _lirs_s_unlink(cache, node);
+    }
+    n->sprev = -1;
+    n->snext = cache->lirs.s.head;
+    if (n->snext >= 0) {
+        nodes[n->snext].sprev = node;
+    } else {
+        cache->lirs.s.tail = node;
+    }
+    cache->lirs.s.head = node;
+    cache->lirs.s.length++;
+    n->in_s = 1;
+}
+
+static void
+_lirs_q_unlink (LCacheP cache, LCacheGhostList * list, int node)
+{
+    LCacheLirsNode * nodes = cache->lirs.nodes;
+    LCacheLirsNode * n = &nodes[node];
+
+    if (n->qprev >= 0) {
+        nodes[n->qprev].qnext = n->qnext;
+    } else {
+        list->head = n->qnext;
+    }
+    if (n->qnext >= 0) {
+        nodes[n->qnext].qprev = n->qprev;
+    } else {
+        list->tail = n->qprev;
+    }
+    list->length--;
+}
+
+static void
+_lirs_q_push (LCacheP cache, LCacheGhostList * list, int node)
+{
+    LCacheLirsNode * nodes = cache->lirs.nodes;
+    LCacheLirsNode * n = &nodes[node];
+
+    n->qprev = -1;
+    n->qnext = list->head;
+    if (n->qnext >= 0) {
+        nodes[n->qnext].qprev = node;
+    } else {
+        list->tail = node;
+    }
+    list->head = node;
+    list->length++;
+}
+
+static int
+_lirs_node_new (LCacheP cache, uint64_t hash)
+{
+    int node = cache->lirs.free;
+    LCacheLirsNode * n = &cache->lirs.nodes[node];
+
+    cache->lirs.free = n->snext;
+    memset(n, 0, sizeof (LCacheLirsNode));
+    n->hash = hash;
+    _index_insert(&cache->lirs.index, hash, node);
+    return node;
+}
+
+static void
+_lirs_node_free (LCacheP cache, int node)
+{
+    LCacheLirsNode * n = &cache->lirs.nodes[node];
+
+    _index_remove(&cache->lirs.index, n->hash, node);
+    n->state = L_CACHE_LIRS_FREE;
+    n->item = NULL;
+    n->snext = cache->lirs.free;
+    cache->lirs.free = node;
+}
+
+/**
+ * Stack pruning: pops the HIR blocks off the bottom of S until a LIR block
+ * is there. Every block is popped at most once per push, so the cost is
+ * amortized O(1).
+ */
+static void
+_lirs_prune (LCacheP cache)
+{
+    int bottom;
+
+    while ((bottom = cache->lirs.s.tail) >= 0 &&
+           cache->lirs.nodes[bottom].state != L_CACHE_LIRS_LIR) {
+        _lirs_s_unlink(cache, bottom);
+        if (cache->lirs.nodes[bottom].state == L_CACHE_LIRS_NONRESIDENT) {
+            _lirs_q_unlink(cache, &cache->lirs.nonresident, bottom);
+            _lirs_node_free(cache, bottom);
+        }
+    }
+}
+
+/**
+ * Turns the LIR block at the bottom of S into a resident HIR block at the
+ * end of Q, once another block was promoted to LIR.
+ */
+static void
+_lirs_demote_bottom (LCacheP cache)
+{
+    int bottom = cache->lirs.s.tail;
+
+    if (bottom < 0 || cache->lirs.nodes[bottom].state != L_CACHE_LIRS_LIR) {
+        return;
+    }
+    _lirs_s_unlink(cache, bottom);
+    cache->lirs.nodes[bottom].state = L_CACHE_LIRS_HIR;
+    _lirs_q_push(cache, &cache->lirs.q, bottom);
+    cache->lirs.lir_length--;
+    _lirs_prune(cache);
+}
+
+static void
+_lirs_insert (LCacheP cache, LCacheItemP item)
+{
+    int node = _index_find(&cache->lirs.index, item->hash);
+    LCacheLirsNode * n;
+
+    if (node >= 0) {
+        /* a non-resident block still in S: its reuse distance beats the
+         * recency of the bottom LIR block */
+        n = &cache->lirs.nodes[node];
+        _lirs_q_unlink(cache, &cache->lirs.nonresident, node);
+        n->item = item;
+        n->state = L_CACHE_LIRS_LIR;
+        _lirs_s_push(cache, node);
+        if (++cache->lirs.lir_length > cache->lirs.lir_capacity) {
+            _lirs_demote_bottom(cache);
+        }
+    } else {
+        node = _lirs_node_new(cache, item->hash);
+        n = &cache->lirs.nodes[node];
+        n->item = item;
+        _lirs_s_push(cache, node);
+        if (cache->lirs.lir_length < cache->lirs.lir_capacity) {
+            n->state = L_CACHE_LIRS_LIR;
+            cache->lirs.lir_length++;
+        } else {
+            n->state = L_CACHE_LIRS_HIR;
+            _lirs_q_push(cache, &cache->lirs.q, node);
+        }
+    }
+    item->node = node;
+}
+
+static void
+_lirs_hit (LCacheP cache, LCacheItemP item)
+{
+    int node = item->node;
+    LCacheLirsNode * n = &cache->lirs.nodes[node];
+
+    if (n->state == L_CACHE_LIRS_LIR) {
+        bool bottom = cache->lirs.s.tail == node;
+        _lirs_s_push(cache, node);
+        if (bottom) {
+            _lirs_prune(cache);
+        }
+    } else if (n->in_s) {
+        /* resident HIR block with a short reuse distance becomes LIR */
+        _lirs_q_unlink(cache, &cache->lirs.q, node);
+        n->state = L_CACHE_LIRS_LIR;
+        _lirs_s_push(cache, node);
+        cache->lirs.lir_length++;
+        _lirs_demote_bottom(cache);
+    } else {
+        _lirs_s_push(cache, node);
+        _lirs_q_unlink(cache, &cache->lirs.q, node);
+        _lirs_q_push(cache, &cache->lirs.q, node);
+    }
+}
+
+static void
+_lirs_remove (LCacheP cache, LCacheItemP item)
+{
+    int node = item->node;
+    LCacheLirsNode * n = &cache->lirs.nodes[node];
+
+    if (n->state == L_CACHE_LIRS_LIR) {
+        bool bottom = cache->lirs.s.tail == node;
+        _lirs_s_unlink(cache, node);
+        _lirs_node_free(cache, node);
+        cache->lirs.lir_length--;
+        if (bottom) {
+            _lirs_prune(cache);
+        }
+        return;
+    }
+
+    _lirs_q_unlink(cache, &cache->lirs.q, node);
+    if (!n->in_s) {
+        _lirs_node_free(cache, node);
+        return;
+    }
+    /* keep the block in S to notice a short reuse distance on its next miss */
+    n->item = NULL;
+    n->state = L_CACHE_LIRS_NONRESIDENT;
+    _lirs_q_push(cache, &cache->lirs.nonresident, node);
+    if (cache->lirs.nonresident.length > cache->lirs.nonresident_capacity) {
+        int oldest = cache->lirs.nonresident.tail;
+        _lirs_q_unlink(cache, &cache->lirs.nonresident, oldest);
+        _lirs_s_unlink(cache, oldest);
+        _lirs_node_free(cache, oldest);
+    }
+}
+
+static LCacheItemP
+_lirs_victim (LCacheP cache, LCacheItemP incoming)
+{
+    L_UNUSED_VAR(incoming);
+    if (cache->lirs.q.tail >= 0) {
+        return cache->lirs.nodes[cache->lirs.q.tail].item;
+    }
+    /* only LIR blocks are resident: give up the least recent one */
+    if (cache->lirs.s.tail >= 0) {
+        return cache->lirs.nodes[cache->lirs.s.tail].item;
+    }
+    return NULL;
+}
+
+static bool
+_lirs_init (LCacheP cache)
+{
+    int i;
+    int count = 2 * cache->capacity;
+
+    cache->lirs.nodes = l_calloc (sizeof (LCacheLirsNode), count);
+    if (NULL == cache->lirs.nodes || !_index_init(&cache->lirs.index, count)) {
+        l_free(cache->lirs.nodes);
+        cache->lirs.nodes = NULL;
+        return false;
+    }
+    cache->lirs.capacity = count;
+    for (i = 0; i < count; i++) {
+        cache->lirs.nodes[i].snext = i + 1 < count ? i + 1 : -1;
+    }
+    cache->lirs.free = 0;
+    cache->lirs.s.head = cache->lirs.s.tail = -1;
+    cache->lirs.q.head = cache->lirs.q.tail = -1;
+    cache->lirs.nonresident.head = cache->lirs.nonresident.tail = -1;
+    cache->lirs.nonresident_capacity = cache->capacity;
+    return true;
+}
+
+static void
+_lirs_destroy (LCacheP cache)
+{
+    l_free(cache->lirs.nodes);
+    cache->lirs.nodes = NULL;
+    _index_destroy(&cache->lirs.index);
+}
+
+static const LCachePolicy _lirs_policy = {
+    _lirs_insert, _lirs_hit, _lirs_remove, _lirs_victim, _lirs_init, _lirs_destroy, NULL, NULL
+};
+
+/* L_CACHE_LFU: O(1) frequency buckets, least recently used first among equals */
+
+static LCacheFrequency *
+_lfu_bucket_after (LCacheP cache, LCacheFrequency * prev, unsigned long count)
+{
+    LCacheFrequency * next = prev ? prev->next : cache->lfu.lowest;
+    LCacheFrequency * bucket;
+
+    if (next && next->count == count) {
+        return next;
+    }
+    bucket = l_calloc (sizeof (LCacheFrequency), 1);
+    if (NULL == bucket) {
+        return NULL;
+    }
+    bucket->count = count;
+    bucket->prev = prev;
+    bucket->next = next;
+    if (next) {
+        next->prev = bucket;
+    }
+    if (prev) {
+        prev->next = bucket;
+    } else {
+        cache->lfu.lowest = bucket;
+    }
+    return bucket;
+}
+
+static void
+_lfu_bucket_release (LCacheP cache, LCacheFrequency * bucket)
+{
+    if (bucket->items.length > 0) {
+        return;
+    }
+    if (bucket->prev) {
+        bucket->prev->next = bucket->next;
+    } else {
+        cache->lfu.lowest = bucket->next;
+    }
+    if (bucket->next) {
+        bucket->next->prev = bucket->prev;
+    }
+    l_free(bucket);
+}
+
+static void
+_lfu_insert (LCacheP cache, LCacheItemP item)
+{
+    item->bucket = _lfu_bucket_after(cache, NULL, 1);
+    if (NULL == item->bucket) {
+        /* out of memory: count the item with the lowest bucket */
+        item->bucket = cache->lfu.lowest;
+    }
+    item->access_count = item->bucket ? item->bucket->count : 0;
+    if (item->bucket) {
+        _list_push_head(&item->bucket->items, item);
+    }
+}
+
+static void
+_lfu_hit (LCacheP cache, LCacheItemP item)
+{
+    LCacheFrequency * from = item->bucket;
+    LCacheFrequency * to;
+
+    if (NULL == from) {
+        _lfu_insert(cache, item);
+        return;
+    }
+    to = _lfu_bucket_after(cache, from, from->count + 1);
+    if (NULL == to) {
+        _list_move_to_head(&from->items, item);
+        return;
+    }
+    _list_unlink(&from->items, item);
+    _list_push_head(&to->items, item);
+    item->bucket = to;
+    item->access_count = to->count;
+    _lfu_bucket_release(cache, from);
+}
+
+static void
+_lfu_remove (LCacheP cache, LCacheItemP item)
+{
+    LCacheFrequency * bucket = item->bucket;
+
+    if (bucket) {
+        _list_unlink(&bucket->items, item);
+        item->bucket = NULL;
+        _lfu_bucket_release(cache, bucket);
+    }
+}
+
+static LCacheItemP
+_lfu_victim (LCacheP cache, LCacheItemP incoming)
+{
+    L_UNUSED_VAR(incoming);
+    return cache->lfu.lowest ? cache->lfu.lowest->items.tail : NULL;
+}
+
+/**
+ * Halves every access count, so keys that used to be hot lose their lead
+ * over the current ones. Buckets whose halved counts collide are merged,
+ * the items from the higher count landing on the most recent side.
+ */
+static void
+_lfu_age (LCacheP cache)
+{
+    LCacheFrequency * bucket = cache->lfu.lowest;
+
+    while (bucket) {
+        LCacheFrequency * next = bucket->next;
+        LCacheFrequency * prev = bucket->prev;
+        unsigned long count = bucket->count > 1 ? bucket->count / 2 : 1;
+        LCacheItemP item;
+
+        for (item = bucket->items.head; item; item = item->next) {
+            item->access_count = count;
+        }
+        if (prev && prev->count == count) {
+            for (item = bucket->items.head; item; item = item->next) {
+                item->bucket = prev;
+            }
+            if (bucket->items.tail) {
+                bucket->items.tail->next = prev->items.head;
+                if (prev->items.head) {
+                    prev->items.head->prev = bucket->items.tail;
+                } else {
+                    prev->items.tail = bucket->items.tail;
+                }
+                prev->items.head = bucket->items.head;
+                prev->items.length += bucket->items.length;
+            }
+            bucket->items.head = bucket->items.tail = NULL;
+            bucket->items.length = 0;
+            _lfu_bucket_release(cache, bucket);
+        } else {
+            bucket->count = count;
+        }
+        bucket = next;
+    }
+}
+
+static void
+_lfu_destroy (LCacheP cache)
+{
+    while (cache->lfu.lowest) {
+        LCacheFrequency * next = cache->lfu.lowest->next;
+        l_free(cache->lfu.lowest);
+        cache->lfu.lowest = next;
+    }
+}
+
+static const LCachePolicy _lfu_policy = {
+    _lfu_insert, _lfu_hit, _lfu_remove, _lfu_victim, NULL, _lfu_destroy, _lfu_age, NULL
+};
+
+/* L_CACHE_GDSF: GreedyDual-Size-Frequency. The victim is the item of least
+ * priority in a min-heap; the victim priority inflates the priority of the
+ * items inserted or hit afterwards, so idle expensive items age out too */
+
+static void
+_gdsf_place (LCacheP cache, LCacheItemP item, int index)
+{
+    cache->gdsf.heap[index] = item;
+    item->node = index;
+}
+
+static void
+_gdsf_sift_up (LCacheP cache, LCacheItemP item)
+{
+    int index = item->node;
+
+    while (index > 0) {
+        LCacheItemP parent = cache->gdsf.heap[(index - 1) / 2];
+        if (parent->priority <= item->priority) {
+            break;
+        }
+        _gdsf_place(cache, parent, index);
+        index = (index - 1) / 2;
+    }
+    _gdsf_place(cache, item, index);
+}
+
+static void
+_gdsf_sift_down (LCacheP cache, LCacheItemP item)
+{
+    int index = item->node;
+
+    for (;;) {
+        int child = 2 * index + 1;
+        if (child >= cache->gdsf.length) {
+            break;
+        }
+        if (child + 1 < cache->gdsf.length &&
+            cache->gdsf.heap[child + 1]->priority < cache->gdsf.heap[child]->priority) {
+            child++;
+        }
+        if (item->priority <= cache->gdsf.heap[child]->priority) {
+            break;
+        }
+        _gdsf_place(cache, cache->gdsf.heap[child], index);
+        index = child;
+    }
+    _gdsf_place(cache, item, index);
+}
+
+static void
+_gdsf_prioritize (LCacheP cache, LCacheItemP item)
+{
+    item->priority = cache->gdsf.inflation + item->access_count * item->cost / item->size;
+}
+
+static void
+_gdsf_insert (LCacheP cache, LCacheItemP item)
+{
+    item->access_count = 1;
+    _gdsf_prioritize(cache, item);
+    item->node = cache->gdsf.length++;
+    _gdsf_sift_up(cache, item);
+}
+
+static void
+_gdsf_hit (LCacheP cache, LCacheItemP item)
+{
+    double priority = item->priority;
+
+    item->access_count++;
+    _gdsf_prioritize(cache, item);
+    /* an overwrite may have lowered the cost */
+    if (item->priority < priority) {
+        _gdsf_sift_up(cache, item);
+    } else {
+        _gdsf_sift_down(cache, item);
+    }
+}
+
+static void
+_gdsf_remove (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP last = cache->gdsf.heap[--cache->gdsf.length];
+
+    if (last == item) {
+        return;
+    }
+    last->node = item->node;
+    cache->gdsf.heap[last->node] = last;
+    if (last->priority < item->priority) {
+        _gdsf_sift_up(cache, last);
+    } else {
+        _gdsf_sift_down(cache, last);
+    }
+}
+
+static LCacheItemP
+_gdsf_victim (LCacheP cache, LCacheItemP incoming)
+{
+    LCacheItemP victim = cache->gdsf.heap[0];
+
+    L_UNUSED_VAR(incoming);
+    return victim;
+}
+
+/**
+ * Raises the priorities of the next items to the one of the evicted \e victim.
+ */
+static void
+_gdsf_evict (LCacheP cache, LCacheItemP victim)
+{
+    cache->gdsf.inflation = victim->priority;
+}
+
+static bool
+_gdsf_init (LCacheP cache)
+{
+    cache->gdsf.heap = l_calloc (sizeof (LCacheItemP), cache->capacity);
+    return NULL != cache->gdsf.heap;
+}
+
+static void
+_gdsf_destroy (LCacheP cache)
+{
+    l_free(cache->gdsf.heap);
+    cache->gdsf.heap = NULL;
+}
+
+static const LCachePolicy _gdsf_policy = {
+    _gdsf_insert, _gdsf_hit, _gdsf_remove, _gdsf_victim, _gdsf_init, _gdsf_destroy, NULL,
+    _gdsf_evict
+};
+
+/* L_CACHE_PLRU: a set-associative table with a tree-PLRU bit word per set,
+ * used instead of the LHash storage and the item allocations */
+
+/**
+ * Maps \e hash onto the sets with a multiply instead of a modulo.
+ */
+static LCachePlruSet *
+_plru_set (LCacheP cache, uint64_t hash)
+{
+    return &cache->plru.sets[((hash & 0xffffffffULL) * cache->plru.set_count) >> 32];
+}
+
+static uint16_t
+_plru_tag (uint64_t hash)
+{
+    uint16_t tag = hash >> 48;
+    return tag ? tag : 1;
+}
+
+/**
+ * Points the tree bits on the path to \e way away from it.
+ */
+static void
+_plru_touch (LCachePlruSet * set, int way)
+{
+    int node = 0;
+    int level;
+
+    for (level = L_CACHE_PLRU_LEVELS - 1; level >= 0; level--) {
+        int right = (way >> level) & 1;
+        if (right) {
+            set->tree &= ~(1 << node);
+        } else {
+            set->tree |= 1 << node;
+        }
+        node = 2 * node + 1 + right;
+    }
+}
+
+/**
+ * Follows the tree bits to the pseudo least recently used way.
+ */
+static int
+_plru_victim_way (const LCachePlruSet * set)
+{
+    int node = 0;
+    int way = 0;
+    int level;
+
+    for (level = 0; level < L_CACHE_PLRU_LEVELS; level++) {
+        int right = (set->tree >> node) & 1;
+        way = (way << 1) | right;
+        node = 2 * node + 1 + right;
+    }
+    return way;
+}
+
+static uint32_t
+_plru_stamp (LCacheP cache)
+{
+    return (uint32_t)((_cache_now(cache) - cache->plru.epoch) / 1000);
+}
+
+static int
+_plru_find (const LCachePlruSet * set, uint16_t tag, lconstpointer key)
+{
+    int way;
+
+    for (way = 0; way < L_CACHE_PLRU_WAYS; way++) {
+        if (set->tags[way] == tag && set->ways[way].key == key) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+static lpointer
+_plru_get (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    LCachePlruSet * set = _plru_set(cache, hash);
+    int way = _plru_find(set, _plru_tag(hash), key);
+    uint32_t now;
+
+    if (way < 0) {
+        cache->misses++;
+        return NULL;
+    }
+    now = _plru_stamp(cache);
+    if (cache->expire_batch > 0 && cache->object_ttl > 0 &&
+        (int)(now - set->stamps[way]) >= cache->object_ttl) {
+        set->tags[way] = 0;
+        cache->length--;
+        cache->expirations++;
+        cache->misses++;
+        _front_invalidate(cache);
+        return NULL;
+    }
+    if (set->stamps[way] != now) {
+        set->stamps[way] = now;
+    }
+    _plru_touch(set, way);
+    cache->hits++;
+    return set->ways[way].value;
+}
+
+static bool
+_plru_put (LCacheP cache, lpointer key, uint64_t hash, lpointer value)
+{
+    uint16_t tag = _plru_tag(hash);
+    LCachePlruSet * set = _plru_set(cache, hash);
+    int way = _plru_find(set, tag, key);
+
+    if (way < 0) {
+        for (way = 0; way < L_CACHE_PLRU_WAYS && set->tags[way]; way++)
+            ;
+        if (way == L_CACHE_PLRU_WAYS) {
+            way = _plru_victim_way(set);
+            cache->evictions++;
+        } else {
+            cache->length++;
+        }
+        set->tags[way] = tag;
+        set->ways[way].key = key;
+    }
+    set->ways[way].value = value;
+    set->stamps[way] = _plru_stamp(cache);
+    _plru_touch(set, way);
+    _front_invalidate(cache);
+    return true;
+}
+
+/**
+ * Expires the items of the next \e sets sets, returning how many.
+ */
+static int
+_plru_expire (LCacheP cache, int sets)
+{
+    uint32_t now = _plru_stamp(cache);
+    int way, expired = 0;
+
+    for (; sets > 0; sets--) {
+        LCachePlruSet * set = &cache->plru.sets[cache->plru.cursor];
+
+        cache->plru.cursor = (cache->plru.cursor + 1) % cache->plru.set_count;
+        for (way = 0; way < L_CACHE_PLRU_WAYS; way++) {
+            if (set->tags[way] && (int)(now - set->stamps[way]) >= cache->object_ttl) {
+                set->tags[way] = 0;
+                cache->length--;
+                expired++;
+            }
+        }
+    }
+    if (expired > 0) {
+        _front_invalidate(cache);
+    }
+    return expired;
+}
+
+/**
+ * Sizes the table to as many full sets as the capacity allows, at least one.
+ */
+static bool
+_plru_init (LCacheP cache)
+{
+    int sets = cache->capacity / L_CACHE_PLRU_WAYS;
+    void * memory = NULL;
+
+    if (sets < 1) {
+        sets = 1;
+    }
+    if (posix_memalign(&memory, 64, sets * sizeof (LCachePlruSet))) {
+        return false;
+    }
+    memset(memory, 0, sets * sizeof (LCachePlruSet));
+    cache->plru.sets = memory;
+    cache->plru.set_count = sets;
+    cache->plru.epoch = _cache_now(cache);
+    cache->capacity = sets * L_CACHE_PLRU_WAYS;
+    return true;
+}
+
+static void
+_plru_destroy (LCacheP cache)
+{
+    free(cache->plru.sets);
+    cache->plru.sets = NULL;
+}
+
+/* the hooks are never called: the sets replace both storage and policy */
+static const LCachePolicy _plru_policy = {
+    NULL, NULL, NULL, NULL, _plru_init, _plru_destroy, NULL, NULL
+};
+
+static const LCachePolicy *
+_cache_policy_for (const LCacheOptions * options)
+{
+    switch (options->type) {
+    case L_CACHE_LRU:
+        return options->eviction_samples > 0 ? &_sampled_policy : &_lru_policy;
+    case L_CACHE_RR:
+        return &_sampled_policy;
+    case L_CACHE_MRU:
+        return &_mru_policy;
+    case L_CACHE_SLRU:
+        return &_slru_policy;
+    case L_CACHE_ARC:
+        return &_arc_policy;
+    case L_CACHE_CAR:
+        return &_car_policy;
+    case L_CACHE_LIRS:
+        return &_lirs_policy;
+    case L_CACHE_LFU:
+        return &_lfu_policy;
+    case L_CACHE_PLRU:
+        return &_plru_policy;
+    case L_CACHE_GDSF:
+        return &_gdsf_policy;
+    default:
+        return NULL;
+    }
+}
+
+/* TinyLFU admission: a small LRU window in front of the policy, whose
+ * evictions enter the policy only when they look more popular than its victim */
+
+static uint32_t
+_sketch_round (uint32_t n)
+{
+    uint32_t size = 16;
+
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static bool
+_sketch_init (LCacheSketch * sketch, int capacity)
+{
+    /* 8 counters per item, and 8 doorkeeper bits per key of a sample
+     * keep the false positives of both around 3% */
+    uint32_t width = _sketch_round(4 * capacity);
+    uint32_t bits = _sketch_round(80 * capacity);
+
+    sketch->table = l_calloc (sizeof (uint64_t), 4 * (width / 16));
+    sketch->doorkeeper = l_calloc (sizeof (uint64_t), bits / 64 + 1);
+    if (NULL == sketch->table || NULL == sketch->doorkeeper) {
+        l_free(sketch->table);
+        l_free(sketch->doorkeeper);
+        sketch->table = NULL;
+        return false;
+    }
+    sketch->width_mask = width - 1;
+    sketch->doorkeeper_mask = bits - 1;
+    sketch->additions = 0;
+    sketch->sample_size = 10 * capacity;
+    return true;
+}
+
+static void
+_sketch_destroy (LCacheSketch * sketch)
+{
+    l_free(sketch->table);
+    l_free(sketch->doorkeeper);
+    sketch->table = NULL;
+    sketch->doorkeeper = NULL;
+}
+
+/**
+ * Returns the word and shift of the \e row counter of \e hash, using
+ * double hashing over the two halves of the hash.
+ */
+static uint64_t *
+_sketch_counter (const LCacheSketch * sketch, uint64_t hash, int row, int * shift)
+{
+    uint32_t index = ((uint32_t)hash + row * (uint32_t)((hash >> 32) | 1)) & sketch->width_mask;
+
+    *shift = (index & 15) * 4;
+    return &sketch->table[row * ((sketch->width_mask + 1) / 16) + index / 16];
+}
+
+/**
+ * Probes 3 doorkeeper bits of \e hash, setting them when \e set is true.
+ * Returns whether all of them were set before.
+ */
+static bool
+_doorkeeper_probe (LCacheSketch * sketch, uint64_t hash, bool set)
+{
+    bool present = true;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        uint32_t bit = (uint32_t)(hash >> (11 + 17 * i)) & sketch->doorkeeper_mask;
+        uint64_t mask = 1ULL << (bit & 63);
+
+        present = present && (sketch->doorkeeper[bit / 64] & mask);
+        if (set) {
+            sketch->doorkeeper[bit / 64] |= mask;
+        }
+    }
+    return present;
+}
+
+static void
+_sketch_reset (LCacheSketch * sketch)
+{
+    uint32_t i;
+    uint32_t words = 4 * ((sketch->width_mask + 1) / 16);
+
+    for (i = 0; i < words; i++) {
+        sketch->table[i] = (sketch->table[i] >> 1) & 0x7777777777777777ULL;
+    }
+    memset(sketch->doorkeeper, 0, ((sketch->doorkeeper_mask + 1) / 64 + 1) * sizeof (uint64_t));
+    sketch->additions /= 2;
+}
+
+/**
+ * Counts one access to \e hash.
+ */
+static void
+_sketch_record (LCacheSketch * sketch, uint64_t hash)
+{
+    int row, shift;
+
+    if (_doorkeeper_probe(sketch, hash, true)) {
+        for (row = 0; row < 4; row++) {
+            uint64_t * word = _sketch_counter(sketch, hash, row, &shift);
+            if (((*word >> shift) & 15) < 15) {
+                *word += 1ULL << shift;
+            }
+        }
+    }
+    if (++sketch->additions >= sketch->sample_size) {
+        _sketch_reset(sketch);
+    }
+}
+
+static int
+_sketch_estimate (LCacheSketch * sketch, uint64_t hash)
+{
+    int row, shift;
+    int estimate = 15;
+
+    for (row = 0; row < 4; row++) {
+        uint64_t * word = _sketch_counter(sketch, hash, row, &shift);
+        int count = (*word >> shift) & 15;
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate + (_doorkeeper_probe(sketch, hash, false) ? 1 : 0);
+}
+
+/**
+ * Stores a new item in the admission window. The window overflow becomes
+ * a candidate for the policy: it enters while the policy has room, or
+ * replaces the policy victim if the sketch finds it more popular, and is
+ * dropped otherwise.
+ */
+static void
+_admission_insert (LCacheP cache, LCacheItemP item)
+{
+    LCacheItemP candidate;
+    LCacheItemP victim;
+
+    item->windowed = 1;
+    _list_push_head(&cache->admission.window, item);
+    if (cache->admission.window.length <= cache->admission.window_capacity) {
+        return;
+    }
+
+    candidate = cache->admission.window.tail;
+    _list_unlink(&cache->admission.window, candidate);
+    candidate->windowed = 0;
+    if (cache->length - cache->admission.window.length <= cache->capacity) {
+        cache->policy->insert(cache, candidate);
+        return;
+    }
+
+    victim = cache->policy->victim(cache, candidate);
+    if (victim && _sketch_estimate(&cache->admission.sketch, candidate->hash) >
+                  _sketch_estimate(&cache->admission.sketch, victim->hash)) {
+        if (cache->policy->evict) {
+            cache->policy->evict(cache, victim);
+        }
+        cache->evicted_cost += victim->cost;
+        _cache_remove_item(cache, victim);
+        cache->policy->insert(cache, candidate);
+    } else {
+        cache->admission.rejections++;
+        cache->evicted_cost += candidate->cost;
+        _cache_drop_item(cache, candidate);
+    }
+    cache->evictions++;
+}
+
+/**
+ * Records a use of a stored item.
+ */
+static void
+_cache_hit (LCacheP cache, LCacheItemP item)
+{
+    if (item->windowed) {
+        _list_move_to_head(&cache->admission.window, item);
+    } else {
+        cache->policy->hit(cache, item);
+    }
+}
+
+/**
+ * Makes room for \e incoming by evicting the item chosen by the policy.
+ */
+static bool
+_cache_evict (LCacheP cache, LCacheItemP incoming)
+{
+    LCacheItemP victim = cache->policy->victim(cache, incoming);
+    if (NULL != victim) {
+        if (cache->policy->evict) {
+            cache->policy->evict(cache, victim);
+        }
+        cache->evicted_cost += victim->cost;
+        _cache_remove_item(cache, victim);
+        cache->evictions++;
+    }
+    return NULL != victim;
+}
+
+/**
+ * Evicts items of \e cache until \e weight more bytes fit in its weight
+ * budget.
+ */
+static void
+_cache_shed (LCacheP cache, LCacheItemP incoming, size_t weight)
+{
+    while (cache->length > 0 && cache->weight + weight > cache->max_weight &&
+           _cache_evict(cache, incoming))
+        ;
+}
+
+/**
+ * Returns the weight of \e item: its value, of \e size bytes unless the
+ * cache has a weigher, its key copy when kept out of the item, and the
+ * overhead of the item.
+ */
+static inline size_t
+_cache_weigh (LCacheP cache, LCacheItemP item)
+{
+    size_t weight = cache->weigher ? cache->weigher(item->key, item->value) : item->size;
+
+    if (item->key_owned) {
+        weight += _key_length(cache, item->key) + L_CACHE_HEAP_OVERHEAD;
+    }
+    return weight + cache->item_overhead;
+}
+
+static void
+_front_free (LCacheFront * front)
+{
+    l_free(front->slots);
+    l_free(front);
+}
+
+/**
+ * Releases the front table of an exiting thread.
+ */
+static void
+_front_release (void * data)
+{
+    LCacheFront * front = data;
+    LCacheP cache = front->cache;
+    LCacheFront ** link;
+
+    pthread_mutex_lock(&cache->front.lock);
+    for (link = &cache->front.tables; *link != front; link = &(*link)->next)
+        ;
+    *link = front->next;
+    cache->front.retired_hits += front->hits;
+    pthread_mutex_unlock(&cache->front.lock);
+    _front_free(front);
+}
+
+static bool
+_front_init (LCacheP cache, const LCacheOptions * options)
+{
+    if (pthread_key_create(&cache->front.key, _front_release)) {
+        return false;
+    }
+    pthread_mutex_init(&cache->front.lock, NULL);
+    cache->front.slots = options->front_slots;
+    cache->front.promotion = options->front_promotion;
+    return true;
+}
+
+static void
+_front_destroy (LCacheP cache)
+{
+    LCacheFront * front;
+
+    if (0 == cache->front.slots) {
+        return;
+    }
+    pthread_key_delete(cache->front.key);
+    while (NULL != (front = cache->front.tables)) {
+        cache->front.tables = front->next;
+        _front_free(front);
+    }
+    pthread_mutex_destroy(&cache->front.lock);
+}
+
+/**
+ * Releases the storage, the policy state and \e cache itself.
+ */
+static void
+_cache_free (LCacheP cache)
+{
+    int i;
+
+    if (cache->shards) {
+        for (i = 0; i < (1 << cache->shard_bits); i++) {
+            if (cache->shards[i]) {
+                pthread_mutex_destroy(&cache->shards[i]->lock);
+                _cache_free(cache->shards[i]);
+            }
+        }
+        l_free(cache->shards);
+        free(cache->read_counters);
+        _front_destroy(cache);
+        free(cache->front.generations);
+        free(cache->clock);
+        l_free(cache);
+        return;
+    }
+    if (cache->storage) {
+        l_hash_destroy(cache->storage);
+    }
+    if (cache->rcu.buckets) {
+        _rcu_destroy(cache);
+    }
+    if (cache->flat.table.ctrl) {
+        _flat_destroy(cache);
+    }
+    if (cache->policy->destroy) {
+        cache->policy->destroy(cache);
+    }
+    _sketch_destroy(&cache->admission.sketch);
+    _slab_destroy(cache);
+    l_free(cache->wheel.slots);
+    if (cache->clock && cache->clock->owner == cache) {
+        free(cache->clock);
+    }
+    l_free (cache);
+}
+
+/**
+ * Creates a new unbounded LRU LCache object with integers for keys and values.
+ *
+ * @see l_cache_new_full()
+ *
+ * @returns a new LCache object.
+ */
+
+LCache * l_cache_new (LCache ** cache, int ttl, int cleanup) {
+    return l_cache_new_full(cache, L_CACHE_LRU, 0, ttl, cleanup);
+}
+
+/**
+ * Creates a new LCache object with integers for keys and values.
+ *
+ * Once \e capacity items are stored, every insertion of a new key first
+ * evicts the item selected by the \e type replacement policy.
+ * L_CACHE_PLRU rounds \e capacity down to whole sets of 4 ways.
+ *
+ * @param cache where to store the new cache
+ * @param type the replacement policy
+ * @param capacity the maximum number of items, 0 for an unbounded cache
+ * @param ttl item time-to-live in seconds, 0 to disable expiration
+ * @param cleanup seconds between expiration sweeps, 0 to disable the sweep thread
+ *
+ * @see l_cache_new_with_options()
+ *
+ * @returns a new LCache object, or NULL if \e type is not supported.
+ */
+LCache *
+l_cache_new_full (LCache ** cache, LCacheType type, int capacity, int ttl, int cleanup)
+{
+    LCacheOptions options;
+
+    l_cache_options_init(&options);
+    options.type = type;
+    options.capacity = capacity;
+    options.ttl = ttl;
+    options.cleanup = cleanup;
+    return l_cache_new_with_options(cache, &options);
+}
+
+/**
+ * Fills \e options with the defaults: an unbounded LRU cache without
+ * expiration, an 80% protected segment for L_CACHE_SLRU, 1% of the
+ * capacity for the resident HIR blocks of L_CACHE_LIRS, no admission
+ * filter, with a 1% window when it is enabled, an exact recency list
+ * for L_CACHE_LRU, LHash storage without a size hint, items allocated
+ * one by one, no weight budget, integer keys, no locking, no
+ * thread-free expiration, no refresh-ahead, no front caches, promoting a value on its second hit
+ * when they are enabled, and a clock read at each operation.
+ *
+ * @param options the options to initialize
+ */
+void
+l_cache_options_init (LCacheOptions * options)
+{
+    options->type = L_CACHE_LRU;
+    options->capacity = 0;
+    options->ttl = 0;
+    options->cleanup = 0;
+    options->protected_ratio = 0.8;
+    options->hir_ratio = 0.01;
+    options->admission = false;
+    options->admission_window = 0.01;
+    options->eviction_samples = 0;
+    options->shards = 0;
+    options->lock_free_reads = false;
+    options->flat_storage = false;
+    options->size_hint = 0;
+    options->item_slabs = false;
+    options->weigher = NULL;
+    options->max_weight = 0;
+    options->key_type = L_CACHE_KEY_INT;
+    options->key_size = 0;
+    options->expire_batch = 0;
+    options->refresh_ahead = 0.0;
+    options->refresh_beta = 0.0;
+    options->refresh_workers = 0;
+    options->front_slots = 0;
+    options->front_promotion = 2;
+    options->clock_resolution = 0;
+}
+
+/**
+ * Creates the clock of \e cache.
+ */
+static bool
+_clock_init (LCacheP cache, const LCacheOptions * options)
+{
+    void * memory = NULL;
+
+    if (posix_memalign(&memory, 64, sizeof (LCacheClock))) {
+        return false;
+    }
+    cache->clock = memset(memory, 0, sizeof (LCacheClock));
+    cache->clock->resolution = options->clock_resolution;
+    cache->clock->owner = cache;
+    return true;
+}
+
+/**
+ * Returns the bytes of an item: the caches copying their keys give it a
+ * buffer for the short ones, the size of a binary key when it fits.
+ */
+static size_t
+_cache_item_size (const LCacheOptions * options)
+{
+    size_t size = offsetof (LCacheItem, key_inline);
+
+    if (options->key_type == L_CACHE_KEY_STRING_COPY) {
+        size += L_CACHE_KEY_INLINE;
+    } else if (options->key_type == L_CACHE_KEY_BINARY && options->key_size <= L_CACHE_KEY_INLINE) {
+        size += options->key_size;
+    }
+    if (size < sizeof (LCacheItem)) {
+        size = sizeof (LCacheItem);
+    }
+    /* slab items follow each other */
+    return (size + sizeof (uint64_t) - 1) & ~(sizeof (uint64_t) - 1);
+}
+
+/**
+ * Returns the bytes an item costs besides its key and value: the item
+ * itself and its share of the storage, heap block headers included.
+ */
+static size_t
+_cache_item_overhead (const LCacheOptions * options)
+{
+    size_t overhead;
+
+    if (options->item_slabs) {
+        overhead = L_CACHE_SLAB_BYTES / L_CACHE_SLAB_ITEMS (_cache_item_size(options));
+    } else {
+        overhead = _cache_item_size(options) + L_CACHE_HEAP_OVERHEAD;
+    }
+    if (options->lock_free_reads) {
+        overhead += sizeof (LCacheItemP);
+    } else if (options->flat_storage || options->key_type != L_CACHE_KEY_INT) {
+        /* a slot and its control byte, at the maximum load of 7/8 */
+        overhead += (sizeof (LCacheFlatSlot) + 1) * 8 / 7;
+    } else {
+        /* the LHash node: key, value, hash and chain, plus its bucket */
+        overhead += 4 * sizeof (lpointer) + L_CACHE_HEAP_OVERHEAD + sizeof (lpointer);
+    }
+    return overhead;
+}
+
+/**
+ * Creates the storage and the policy state of an unsynchronized cache,
+ * without its cleanup thread. A partition reads the \e clock of its
+ * cache, NULL creates one.
+ */
+static LCacheP
+_cache_new (const LCacheOptions * options, LCacheClock * clock)
+{
+    LCacheP cacheP;
+    int ttl = options->ttl;
+    int cleanup = options->cleanup;
+    int items = options->size_hint > options->capacity ? options->size_hint : options->capacity;
+    const LCachePolicy * policy = _cache_policy_for(options);
+
+    if (NULL == policy || options->capacity < 0 ||
+        ((options->type == L_CACHE_ARC || options->type == L_CACHE_CAR ||
+          options->type == L_CACHE_LIRS || options->type == L_CACHE_PLRU ||
+          options->type == L_CACHE_GDSF || policy == &_sampled_policy) &&
+         options->capacity == 0) ||
+        options->eviction_samples < 0 || options->expire_batch < 0 ||
+        options->protected_ratio < 0.0 || options->protected_ratio >= 1.0 ||
+        options->hir_ratio <= 0.0 || options->hir_ratio >= 1.0 ||
+        (options->admission && (options->capacity < 2 ||
+                                options->type == L_CACHE_ARC || options->type == L_CACHE_CAR ||
+                                options->type == L_CACHE_PLRU ||
+                                options->admission_window <= 0.0 ||
+                                options->admission_window >= 1.0))) {
+        fprintf(stderr, "[cache] unsupported policy %d (capacity %d)\n",
+                options->type, options->capacity);
+        return NULL;
+    }
+
+    cacheP = l_calloc (sizeof (LCache), 1);
+    if (!cacheP)
+        return NULL;
+    cacheP->clock = clock;
+    if (NULL == clock && !_clock_init(cacheP, options)) {
+        l_free (cacheP);
+        return NULL;
+    }
+
+    if (options->type != L_CACHE_PLRU && !options->lock_free_reads && !options->flat_storage &&
+        options->key_type == L_CACHE_KEY_INT) {
+        cacheP->storage = l_hash_new_full (l_hash_int_hash_func,
+                l_hash_int_equal_func, NULL, del_value);
+
+        if (!cacheP->storage) {
+            if (NULL == clock) {
+                free(cacheP->clock);
+            }
+            l_free (cacheP);
+            return NULL;
+        }
+    }
+    cacheP->object_ttl = ttl;
+    cacheP->cleanup_delay = cleanup;
+    cacheP->type = options->type;
+    cacheP->capacity = options->capacity;
+    cacheP->policy = policy;
+    cacheP->sampled.samples = options->type == L_CACHE_RR ? 0 : options->eviction_samples;
+    cacheP->slab.enabled = options->item_slabs;
+    cacheP->max_weight = options->max_weight;
+    cacheP->weigher = options->weigher;
+    cacheP->item_overhead = _cache_item_overhead(options);
+    cacheP->item_size = _cache_item_size(options);
+    cacheP->keys.type = options->key_type;
+    cacheP->keys.size = options->key_size;
+    if (options->lock_free_reads && !_rcu_init(cacheP, items)) {
+        _cache_free(cacheP);
+        return NULL;
+    }
+    /* LHash hashes and compares the keys without the cache: content keys
+     * go to the flat table */
+    if ((options->flat_storage || options->key_type != L_CACHE_KEY_INT) && !options->lock_free_reads &&
+        options->type != L_CACHE_PLRU && !_flat_init(cacheP, items)) {
+        _cache_free(cacheP);
+        return NULL;
+    }
+    if (ttl > 0 && options->type != L_CACHE_PLRU && !_wheel_init(cacheP)) {
+        _cache_free(cacheP);
+        return NULL;
+    }
+    cacheP->expire_batch = options->expire_batch;
+    cacheP->refresh.ahead = options->refresh_ahead;
+    cacheP->refresh.beta = options->refresh_beta;
+    cacheP->refresh.seed = (_cache_key_hash(cacheP) ^ (uint64_t)time(NULL)) | 1;
+    if (options->admission) {
+        /* the policy only manages what the window leaves */
+        cacheP->admission.window_capacity = (int)(options->capacity * options->admission_window);
+        if (cacheP->admission.window_capacity < 1) {
+            cacheP->admission.window_capacity = 1;
+        }
+        cacheP->capacity -= cacheP->admission.window_capacity;
+        if (!_sketch_init(&cacheP->admission.sketch, options->capacity)) {
+            _cache_free(cacheP);
+            return NULL;
+        }
+    }
+    cacheP->slru.protected_capacity = (int)(cacheP->capacity * options->protected_ratio);
+    cacheP->lirs.lir_capacity = cacheP->capacity - (int)(cacheP->capacity * options->hir_ratio);
+    if (cacheP->lirs.lir_capacity >= cacheP->capacity) {
+        /* keep at least one resident HIR block to evict */
+        cacheP->lirs.lir_capacity = cacheP->capacity - 1;
+    }
+    if (policy->init && !policy->init(cacheP)) {
+        _cache_free(cacheP);
+        return NULL;
+    }
+    return cacheP;
+}
+
+/**
+ * Creates the partitions of a concurrent cache, splitting the capacity
+ * evenly between them.
+ */
+static LCacheP
+_cache_new_sharded (const LCacheOptions * options)
+{
+    LCacheOptions shard_options = *options;
+    LCacheP cacheP;
+    int i;
+
+    cacheP = l_calloc (sizeof (LCache), 1);
+    if (!cacheP)
+        return NULL;
+    cacheP->shards = l_calloc (sizeof (LCacheP), options->shards);
+    if (!cacheP->shards) {
+        l_free (cacheP);
+        return NULL;
+    }
+    if (!_clock_init(cacheP, options)) {
+        _cache_free(cacheP);
+        return NULL;
+    }
+    if (options->lock_free_reads) {
+        void * memory = NULL;
+
+        if (posix_memalign(&memory, 64, L_CACHE_READ_STRIPES * sizeof (LCacheReadCounters))) {
+            _cache_free(cacheP);
+            return NULL;
+        }
+        cacheP->read_counters = memset(memory, 0, L_CACHE_READ_STRIPES * sizeof (LCacheReadCounters));
+    }
+    if (options->front_slots > 0) {
+        void * memory = NULL;
+
+        if (posix_memalign(&memory, 64, options->shards * sizeof (LCacheGeneration))) {
+            _cache_free(cacheP);
+            return NULL;
+        }
+        cacheP->front.generations = memset(memory, 0, options->shards * sizeof (LCacheGeneration));
+        if (!_front_init(cacheP, options)) {
+            _cache_free(cacheP);
+            return NULL;
+        }
+    }
+    while ((1 << cacheP->shard_bits) < options->shards) {
+        cacheP->shard_bits++;
+    }
+    cacheP->object_ttl = options->ttl;
+    cacheP->cleanup_delay = options->cleanup;
+    cacheP->type = options->type;
+    cacheP->capacity = options->capacity;
+    cacheP->max_weight = options->max_weight;
+    cacheP->keys.type = options->key_type;
+    cacheP->keys.size = options->key_size;
+
+    shard_options.shards = 0;
+    shard_options.capacity = options->capacity / options->shards;
+    shard_options.size_hint = options->size_hint / options->shards;
+    shard_options.max_weight = options->max_weight / options->shards;
+    for (i = 0; i < options->shards; i++) {
+        cacheP->shards[i] = _cache_new(&shard_options, cacheP->clock);
+        if (NULL == cacheP->shards[i]) {
+            _cache_free(cacheP);
+            return NULL;
+        }
+        pthread_mutex_init(&cacheP->shards[i]->lock, NULL);
+        cacheP->shards[i]->locked = true;
+        if (cacheP->front.generations) {
+            cacheP->shards[i]->generation = &cacheP->front.generations[i];
+        }
+    }
+    return cacheP;
+}
+
+static bool _refresh_start (LCacheP cache, int workers);
+static void _refresh_stop (LCacheP cache);
+
+/**
+ * Creates a new LCache object with integers for keys and values, configured
+ * by \e options.
+ *
+ * @param cache where to store the new cache
+ * @param options the cache configuration, see l_cache_options_init()
+ *
+ * @see l_hash_new_full()
+ *
+ * @returns a new LCache object, or NULL if the options are not supported.
+ */
+LCache *
+l_cache_new_with_options (LCache ** cache, const LCacheOptions * options)
+{
+    LCacheP cacheP;
+    int cleanup = options->cleanup;
+
+    if (options->shards < 0 || (options->shards & (options->shards - 1)) ||
+        (options->shards > 0 && options->capacity > 0 && options->capacity < options->shards)) {
+        fprintf(stderr, "[cache] unsupported shard count %d (capacity %d)\n",
+                options->shards, options->capacity);
+        return NULL;
+    }
+    /* lock-free lookups need a policy whose hits only store plain flags */
+    if (options->lock_free_reads &&
+        (options->shards == 0 || options->admission ||
+         !(options->type == L_CACHE_CAR || options->type == L_CACHE_RR ||
+           (options->type == L_CACHE_LRU && options->eviction_samples > 0)))) {
+        fprintf(stderr, "[cache] lock-free reads unsupported by policy %d\n", options->type);
+        return NULL;
+    }
+    if (options->flat_storage && options->lock_free_reads) {
+        fprintf(stderr, "[cache] flat storage unsupported with lock-free reads\n");
+        return NULL;
+    }
+    /* the reloads run concurrently with the callers, on items with a timestamp */
+    if (options->refresh_ahead < 0.0 || options->refresh_ahead >= 1.0 ||
+        options->refresh_beta < 0.0 || options->refresh_workers < 0 ||
+        ((options->refresh_ahead > 0.0 || options->refresh_beta > 0.0) &&
+         (options->shards == 0 || options->ttl <= 0 || options->type == L_CACHE_PLRU))) {
+        fprintf(stderr, "[cache] refresh-ahead unsupported without shards and ttl (policy %d)\n",
+                options->type);
+        return NULL;
+    }
+    /* the weight budget evicts any number of items per insertion: only for
+     * the policies whose state is not sized by the item count */
+    if (options->max_weight > 0 &&
+        (options->admission || options->type == L_CACHE_ARC || options->type == L_CACHE_CAR ||
+         options->type == L_CACHE_LIRS || options->type == L_CACHE_PLRU ||
+         (options->shards > 0 && options->max_weight < (size_t)options->shards))) {
+        fprintf(stderr, "[cache] weight budget unsupported by policy %d\n", options->type);
+        return NULL;
+    }
+    /* L_CACHE_PLRU ways and the front tables compare keys by identity */
+    if (options->key_type < L_CACHE_KEY_INT || options->key_type > L_CACHE_KEY_BINARY ||
+        (options->key_type == L_CACHE_KEY_BINARY && 0 == options->key_size) ||
+        (options->key_type != L_CACHE_KEY_INT &&
+         (options->type == L_CACHE_PLRU || options->front_slots > 0))) {
+        fprintf(stderr, "[cache] unsupported key type %d (policy %d)\n",
+                options->key_type, options->type);
+        return NULL;
+    }
+    if (options->ttl < 0) {
+        fprintf(stderr, "[cache] unsupported ttl %d\n", options->ttl);
+        return NULL;
+    }
+    if (options->size_hint < 0) {
+        fprintf(stderr, "[cache] unsupported size hint %d\n", options->size_hint);
+        return NULL;
+    }
+    if (options->clock_resolution < 0) {
+        fprintf(stderr, "[cache] unsupported clock resolution %d\n", options->clock_resolution);
+        return NULL;
+    }
+    if (options->front_slots < 0 || (options->front_slots & (options->front_slots - 1)) ||
+        (options->front_slots > 0 && (options->shards == 0 || options->front_promotion < 1))) {
+        fprintf(stderr, "[cache] unsupported front cache of %d slots (%d shards)\n",
+                options->front_slots, options->shards);
+        return NULL;
+    }
+    /* the sweep thread locks the partitions: a swept cache gets one */
+    if (options->shards > 0 || cleanup > 0) {
+        LCacheOptions layout = *options;
+
+        layout.shards = options->shards > 0 ? options->shards : 1;
+        cacheP = _cache_new_sharded(&layout);
+    } else {
+        cacheP = _cache_new(options, NULL);
+    }
+    if (NULL == cacheP) {
+        return NULL;
+    }
+    *cache = cacheP;
+
+    /* start thread */
+    if ((cleanup > 0 || options->clock_resolution > 0) && NULL == getenv("LCACHE_NO_THREAD") &&
+        !_cleaner_start(cacheP)) {
+        fprintf(stderr, "[cache] event dispatch thread create failed!\n");
+    }
+    if ((options->refresh_ahead > 0.0 || options->refresh_beta > 0.0) &&
+        !_refresh_start(cacheP, options->refresh_workers > 0 ? options->refresh_workers : 1)) {
+        fprintf(stderr, "[cache] refresh thread create failed!\n");
+        _refresh_stop(cacheP);
+    }
+    return cacheP;
+}
+
+/**
+ * Insert a new key/value pair into \e cache.
+ *
+ * Inserting a key that already exists in the cache will result in that
+ * key/value pair being overwritten. Inserting a new key into a full cache
+ * first evicts the item chosen by the cache replacement policy.
+ *
+ * @param cacheP the cache into which \e key and \e value should be inserted.
+ * @param key the key to insert
+ * @param hash the hash of \e key, see _cache_hash()
+ * @param value the value to insert
+ * @param cost the price of rebuilding \e value
+ * @param size the size of \e value, 0 counts as 1
+ * @param ttl the time-to-live of \e value in milliseconds, 0 if it does not
+ * expire
+ * @return FALSE if out of memory. Otherwise return TRUE
+ */
+static bool
+_cache_store (LCacheP cacheP, lpointer key, uint64_t hash, lpointer value, double cost,
+              size_t size, uint32_t ttl)
+{
+    LCacheItemP itemP;
+
+    if (cacheP->expire_batch > 0) {
+        _cache_expire_step(cacheP);
+    }
+    if (cacheP->plru.sets) {
+        return _plru_put(cacheP, key, hash, value);
+    }
+    itemP = _storage_lookup(cacheP, key, hash);
+    if (NULL != itemP) {
+        /* overwrite in place, so the item keeps its links in the policy */
+        __atomic_store_n(&itemP->value, value, __ATOMIC_RELEASE);
+        itemP->cost = cost;
+        itemP->size = size ? size : 1;
+        cacheP->weight -= itemP->weight;
+        itemP->weight = _cache_weigh(cacheP, itemP);
+        cacheP->weight += itemP->weight;
+        itemP->stored = _cache_now(cacheP);
+        __atomic_store_n(&itemP->last_accessed, itemP->stored, __ATOMIC_RELAXED);
+        if (itemP->timer_slot) {
+            _wheel_unlink(cacheP, itemP);
+        }
+        __atomic_store_n(&itemP->ttl, ttl, __ATOMIC_RELAXED);
+        if (ttl > 0 && (cacheP->wheel.slots || _wheel_init(cacheP))) {
+            _wheel_schedule(cacheP, itemP, _wheel_deadline(cacheP, itemP));
+        }
+        _cache_hit(cacheP, itemP);
+        _front_invalidate(cacheP);
+        if (cacheP->max_weight > 0 && itemP->weight > cacheP->max_weight) {
+            /* heavier than the whole budget: only the item itself leaves */
+            cacheP->evictions++;
+            cacheP->evicted_cost += cost;
+            _cache_remove_item(cacheP, itemP);
+        } else if (cacheP->max_weight > 0) {
+            /* a value that grew can push the item itself out */
+            _cache_shed(cacheP, NULL, 0);
+        }
+        return true;
+    }
+    if (ttl > 0 && NULL == cacheP->wheel.slots && !_wheel_init(cacheP)) {
+        return false;
+    }
+
+    itemP = _item_new(cacheP);
+    if (NULL == itemP) {
+        return false;
+    }
+    itemP->key = key;
+    if (cacheP->keys.type == L_CACHE_KEY_STRING_COPY || cacheP->keys.type == L_CACHE_KEY_BINARY) {
+        if (!_item_copy_key(cacheP, itemP, key)) {
+            _item_free(itemP);
+            return false;
+        }
+    }
+    itemP->hash = hash;
+    itemP->value = value;
+    itemP->cost = cost;
+    itemP->size = size ? size : 1;
+    itemP->last_accessed = _cache_now(cacheP);
+    itemP->stored = itemP->last_accessed;
+    itemP->ttl = ttl;
+    itemP->weight = _cache_weigh(cacheP, itemP);
+
+    if (cacheP->admission.sketch.table) {
+        if (!_storage_insert(cacheP, itemP)) {
+            _item_free(itemP);
+            return false;
+        }
+        cacheP->length++;
+        cacheP->weight += itemP->weight;
+        if (ttl > 0) {
+            _wheel_schedule(cacheP, itemP, _wheel_deadline(cacheP, itemP));
+        }
+        _admission_insert(cacheP, itemP);
+        return true;
+    }
+
+    if (cacheP->max_weight > 0 && itemP->weight > cacheP->max_weight) {
+        /* heavier than the whole budget: evicted as soon as stored */
+        cacheP->evictions++;
+        cacheP->evicted_cost += cost;
+        _item_free(itemP);
+        return true;
+    }
+    if (cacheP->capacity > 0 && cacheP->length >= cacheP->capacity) {
+        _cache_evict(cacheP, itemP);
+    }
+    if (cacheP->max_weight > 0) {
+        _cache_shed(cacheP, itemP, itemP->weight);
+    }
+    if (!_storage_insert(cacheP, itemP)) {
+        _item_free(itemP);
+        return false;
+    }
+    cacheP->policy->insert(cacheP, itemP);
+    cacheP->length++;
+    cacheP->weight += itemP->weight;
+    if (ttl > 0) {
+        _wheel_schedule(cacheP, itemP, _wheel_deadline(cacheP, itemP));
+    }
+    return true;
+}
+
+/**
+ * Returns the time-to-live of the items of \e cache in milliseconds.
+ */
+static inline uint32_t
+_cache_ttl (LCacheP cache)
+{
+    if (cache->object_ttl <= 0) {
+        return 0;
+    }
+    if ((int64_t)cache->object_ttl > (int64_t)(UINT32_MAX / 1000)) {
+        return UINT32_MAX;
+    }
+    return (uint32_t)cache->object_ttl * 1000;
+}
+
+bool
+l_cache_put (LCache ** cache, lpointer key, lpointer value)
+{
+    return l_cache_put_with_cost(cache, key, value, 1.0, 1);
+}
+
+/**
+ * Returns the partition of a concurrent \e cache holding the keys of
+ * \e hash.
+ */
+static LCacheP
+_cache_shard_of (LCacheP cache, uint64_t hash)
+{
+    /* the golden ratio spreads the hash bits the storage indexes use */
+    if (cache->shard_bits > 0) {
+        return cache->shards[(hash * 0x9e3779b97f4a7c15ULL) >> (64 - cache->shard_bits)];
+    }
+    return cache->shards[0];
+}
+
+/**
+ * Returns the partition of a concurrent \e cache holding the keys of
+ * \e hash, locked, or \e cache itself.
+ */
+static LCacheP
+_cache_acquire (LCacheP cache, uint64_t hash)
+{
+    if (NULL == cache->shards) {
+        return cache;
+    }
+    cache = _cache_shard_of(cache, hash);
+    pthread_mutex_lock(&cache->lock);
+    return cache;
+}
+
+static void
+_cache_release (LCacheP cache)
+{
+    if (cache->locked) {
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+/**
+ * Inserts a key/value pair like l_cache_put(), with the price of
+ * rebuilding \e value. L_CACHE_GDSF keeps expensive and small values longer;
+ * the other policies only add the cost of their victims to the statistics.
+ * Without a weigher, \e size is also the value weight charged to the
+ * budget of the cache.
+ *
+ * @param cache The LCache
+ * @param key the key to insert
+ * @param value the value to insert
+ * @param cost the price of rebuilding \e value, in microseconds for
+ * consistency with the costs measured by l_cache_get_or_put()
+ * @param size the size of \e value in any unit, in bytes for the weight
+ * budget, 0 counts as 1
+ *
+ * @return FALSE if out of memory. Otherwise return TRUE
+ */
+bool
+l_cache_put_with_cost (LCache ** cache, lpointer key, lpointer value, double cost, size_t size)
+{
+    uint64_t hash = _cache_hash(*cache, key);
+    LCacheP cacheP = _cache_acquire(*cache, hash);
+    bool stored;
+
+    if (cacheP->admission.sketch.table) {
+        _sketch_record(&cacheP->admission.sketch, hash);
+    }
+    stored = _cache_store(cacheP, key, hash, value, cost, size, _cache_ttl(cacheP));
+    _cache_release(cacheP);
+    return stored;
+}
+
+/**
+ * Inserts a key/value pair like l_cache_put(), expiring \e ttl
+ * milliseconds after its last access rather than after the ttl of the
+ * cache. L_CACHE_PLRU keeps the ttl of the cache.
+ *
+ * @param cache The LCache
+ * @param key the key to insert
+ * @param value the value to insert
+ * @param ttl the time-to-live of the pair in milliseconds, 0 if it does not
+ * expire
+ *
+ * @return FALSE if out of memory. Otherwise return TRUE
+ */
+bool
+l_cache_put_with_ttl (LCache ** cache, lpointer key, lpointer value, unsigned int ttl)
+{
+    uint64_t hash = _cache_hash(*cache, key);
+    LCacheP cacheP = _cache_acquire(*cache, hash);
+    bool stored;
+
+    if (cacheP->admission.sketch.table) {
+        _sketch_record(&cacheP->admission.sketch, hash);
+    }
+    stored = _cache_store(cacheP, key, hash, value, 1.0, 1, ttl);
+    _cache_release(cacheP);
+    return stored;
+}
+
+static lpointer
+_cache_lookup (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    lpointer value = NULL;
+    LCacheItemP pitem;
+
+    if (cache->plru.sets) {
+        return _plru_get(cache, key, hash);
+    }
+    if (cache->admission.sketch.table) {
+        _sketch_record(&cache->admission.sketch, hash);
+    }
+    pitem = _storage_lookup(cache, key, hash);
+    if (NULL != pitem && cache->expire_batch > 0 && _cache_item_expired(cache, pitem)) {
+        _cache_remove_item(cache, pitem);
+        cache->expirations++;
+        pitem = NULL;
+    }
+    if (NULL != pitem) {
+        __atomic_store_n(&pitem->last_accessed, _cache_now(cache), __ATOMIC_RELAXED);
+        _cache_hit(cache, pitem);
+        cache->hits++;
+        value = pitem->value;
+    } else {
+        cache->misses++;
+    }
+    return value;
+}
+
+/**
+ * Looks \e key up in a read-optimized cache without taking any lock. The
+ * lookup only writes to shared memory when the access time or the
+ * reference bit of the item change.
+ */
+static lpointer
+_cache_read (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    LCacheReader * reader = _reader_self();
+    LCacheP shard = _cache_shard_of(cache, hash);
+    LCacheReadCounters * counters;
+    LCacheItemP item;
+    lpointer value = NULL;
+    uint64_t now;
+
+    if (NULL == reader) {
+        pthread_mutex_lock(&shard->lock);
+        value = _cache_lookup(shard, key, hash);
+        pthread_mutex_unlock(&shard->lock);
+        return value;
+    }
+    counters = &cache->read_counters[reader->slot % L_CACHE_READ_STRIPES];
+    _reader_enter(reader);
+    item = _storage_lookup(shard, key, hash);
+    if (NULL != item && shard->expire_batch > 0 && _cache_item_expired(shard, item)) {
+        /* left to the next insertion, which holds the lock */
+        item = NULL;
+    }
+    if (NULL != item) {
+        value = __atomic_load_n(&item->value, __ATOMIC_ACQUIRE);
+        now = _cache_now(shard);
+        if (__atomic_load_n(&item->last_accessed, __ATOMIC_RELAXED) != now) {
+            __atomic_store_n(&item->last_accessed, now, __ATOMIC_RELAXED);
+        }
+        shard->policy->hit(shard, item);
+        __atomic_fetch_add(&counters->hits, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&counters->misses, 1, __ATOMIC_RELAXED);
+    }
+    _reader_exit(reader);
+    return value;
+}
+
+/**
+ * Looks \e key, of \e hash, up in the shared cache.
+ */
+static lpointer
+_cache_get (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    LCacheP cacheP;
+    lpointer value;
+
+    if (cache->read_counters) {
+        return _cache_read(cache, key, hash);
+    }
+    cacheP = _cache_acquire(cache, hash);
+    value = _cache_lookup(cacheP, key, hash);
+    _cache_release(cacheP);
+    return value;
+}
+
+/* front caches: each thread keeps the values it reads most in a small
+ * direct-mapped table of its own, valid while the generation counter of
+ * the partition holding the key has not moved. A partition bumps its
+ * counter whenever a value changes or leaves it, so that a front hit is
+ * one hash, the key and generation compares, and no shared write. Front
+ * hits are not seen by the replacement policy nor by the time-to-live:
+ * a copy expires with the item it was taken from */
+
+/**
+ * Returns the front table of the calling thread, created on first use, or
+ * NULL if out of memory.
+ */
+static LCacheFront *
+_front_self (LCacheP cache)
+{
+    LCacheFront * front = pthread_getspecific(cache->front.key);
+
+    if (NULL != front) {
+        return front;
+    }
+    front = l_calloc (sizeof (LCacheFront), 1);
+    if (NULL == front) {
+        return NULL;
+    }
+    front->slots = l_calloc (sizeof (LCacheFrontSlot), cache->front.slots);
+    if (NULL == front->slots) {
+        l_free(front);
+        return NULL;
+    }
+    front->cache = cache;
+    pthread_mutex_lock(&cache->front.lock);
+    front->next = cache->front.tables;
+    cache->front.tables = front;
+    pthread_mutex_unlock(&cache->front.lock);
+    pthread_setspecific(cache->front.key, front);
+    return front;
+}
+
+/**
+ * Finds when the copy of \e key, held by the partition \e part, expires:
+ * the front hits do not delay the expiration of the item. Returns false
+ * if the copy cannot be timed.
+ */
+static bool
+_front_deadline (LCacheP part, lconstpointer key, uint64_t hash, uint64_t * deadline)
+{
+    LCacheItemP item;
+    bool timed = true;
+
+    *deadline = 0;
+    if (part->plru.sets) {
+        /* the ways only keep a coarse stamp */
+        return 0 == part->object_ttl;
+    }
+    pthread_mutex_lock(&part->lock);
+    item = _storage_lookup(part, key, hash);
+    if (NULL == item) {
+        timed = false;
+    } else if (item->ttl > 0) {
+        *deadline = item->last_accessed + item->ttl;
+    }
+    pthread_mutex_unlock(&part->lock);
+    return timed;
+}
+
+/**
+ * Looks \e key up in the front table of the calling thread, then in the
+ * shared cache, copying the value to the front table once the thread has
+ * found it there front.promotion times in a row.
+ */
+static lpointer
+_front_get (LCacheP cache, lconstpointer key, uint64_t hash)
+{
+    LCacheFront * front = _front_self(cache);
+    LCacheFrontSlot * slot;
+    uint64_t generation, deadline;
+    LCacheP part;
+    lpointer value;
+
+    if (NULL == front) {
+        return _cache_get(cache, key, hash);
+    }
+    slot = &front->slots[hash & (cache->front.slots - 1)];
+    if (slot->key == key && NULL != slot->source &&
+        slot->generation == __atomic_load_n(&slot->source->value, __ATOMIC_ACQUIRE) &&
+        (0 == slot->deadline || _cache_now(cache) < slot->deadline)) {
+        /* only this thread writes its counter, read by l_cache_get_stats() */
+        __atomic_store_n(&front->hits, front->hits + 1, __ATOMIC_RELAXED);
+        return slot->value;
+    }
+    part = _cache_shard_of(cache, hash);
+    /* read first: a change made meanwhile leaves the copy stale */
+    generation = __atomic_load_n(&part->generation->value, __ATOMIC_ACQUIRE);
+    value = _cache_get(cache, key, hash);
+    if (NULL == value) {
+        return NULL;
+    }
+    if (slot->candidate != key) {
+        slot->candidate = key;
+        slot->count = 0;
+    }
+    if (++slot->count >= cache->front.promotion &&
+        _front_deadline(part, key, hash, &deadline)) {
+        slot->key = key;
+        slot->value = value;
+        slot->generation = generation;
+        slot->deadline = deadline;
+        slot->source = part->generation;
+    }
+    return value;
+}
+
+/**
+ * Search \e hash for \e key returning the associated value if \e key is
+ * found, NULL otherwise.
+ *
+ * @param hash the hash in which to look for \e key
+ * @param key the key to look for in \e hash.
+ *
+ * @returns the value associated with \e key in \e hash or NULL if no matching
+ * key was found. With front caches, the value may come from the table of
+ * the calling thread.
+ */
+lpointer
+l_cache_get (LCache ** cache,
+               lconstpointer key)
+{
+    uint64_t hash = _cache_hash(*cache, key);
+
+    if ((*cache)->front.slots) {
+        return _front_get(*cache, key, hash);
+    }
+    return _cache_get(*cache, key, hash);
+}
+
+/**
+ * Return total quantity of objects currently in \e cache.
+ * Note, that stale (see options) items are returned as part of this item count.
+ *
+ * @param cache The LCache
+ *
+ * @returns cached items count.
+ */
+int
+l_cache_get_length(LCache ** cache)
+{
+    int i, length = 0;
+
+    if (NULL == (*cache)->shards) {
+        return (*cache)->length;
+    }
+    for (i = 0; i < (1 << (*cache)->shard_bits); i++) {
+        length += __atomic_load_n(&(*cache)->shards[i]->length, __ATOMIC_RELAXED);
+    }
+    return length;
+}
+
+/**
+ * Returns the summed weight of the items of \e cache, in bytes with the
+ * default item overhead.
+ *
+ * @param cache The LCache
+ *
+ * @see LCacheOptions.weigher
+ */
+size_t
+l_cache_get_weight(LCache ** cache)
+{
+    size_t weight = 0;
+    int i;
+
+    if (NULL == (*cache)->shards) {
+        return (*cache)->weight;
+    }
+    for (i = 0; i < (1 << (*cache)->shard_bits); i++) {
+        weight += __atomic_load_n(&(*cache)->shards[i]->weight, __ATOMIC_RELAXED);
+    }
+    return weight;
+}
+
+/**
+ * Adds the counters of an unsynchronized cache or partition to \e stats.
+ */
+static void
+_cache_add_stats (LCacheP cacheP, LCacheStats * stats)
+{
+    stats->length += cacheP->length;
+    stats->capacity += cacheP->capacity + cacheP->admission.window_capacity;
+    stats->weight += cacheP->weight;
+    stats->max_weight += cacheP->max_weight;
+    stats->window_length += cacheP->admission.window.length;
+    stats->admission_rejections += cacheP->admission.rejections;
+    stats->hits += cacheP->hits;
+    stats->misses += cacheP->misses;
+    stats->evictions += cacheP->evictions;
+    stats->evicted_cost += cacheP->evicted_cost;
+    stats->loads += cacheP->loads;
+    stats->coalesced_loads += cacheP->coalesced;
+    stats->refreshes += cacheP->refreshes;
+    stats->expirations += cacheP->expirations;
+    stats->resizes += cacheP->flat.resizes;
+    if (cacheP->expire_time_max > stats->expire_time_max) {
+        stats->expire_time_max = cacheP->expire_time_max;
+    }
+    stats->load_time += cacheP->load_time;
+    if (cacheP->type == L_CACHE_SLRU) {
+        stats->probationary_length += cacheP->slru.probation.length;
+        stats->protected_length += cacheP->slru.protect.length;
+    } else if (cacheP->type == L_CACHE_ARC || cacheP->type == L_CACHE_CAR) {
+        stats->probationary_length += cacheP->arc.t1.length;
+        stats->protected_length += cacheP->arc.t2.length;
+        stats->ghost_length += cacheP->arc.ghosts.lists[L_CACHE_GHOST_B1].length +
+                               cacheP->arc.ghosts.lists[L_CACHE_GHOST_B2].length;
+        stats->ghost_bytes += _ghosts_bytes(&cacheP->arc.ghosts);
+        stats->adaptive_target += cacheP->arc.p;
+    } else if (cacheP->type == L_CACHE_LIRS) {
+        stats->probationary_length += cacheP->lirs.q.length;
+        stats->protected_length += cacheP->lirs.lir_length;
+        stats->ghost_length += cacheP->lirs.nonresident.length;
+        stats->ghost_bytes += cacheP->lirs.capacity * sizeof (LCacheLirsNode) +
+                              _index_bytes(&cacheP->lirs.index);
+    } else if (cacheP->type == L_CACHE_GDSF && cacheP->gdsf.inflation > stats->inflation) {
+        stats->inflation = cacheP->gdsf.inflation;
+    }
+    stats->slab_bytes += (size_t)cacheP->slab.count * L_CACHE_SLAB_BYTES;
+    stats->slab_items += cacheP->slab.used;
+    /* the slots of the slabs, and the free ones of the slabs in use, turned
+     * into shares by _slab_stats() */
+    stats->slab_occupancy += (double)cacheP->slab.count * L_CACHE_SLAB_ITEMS (cacheP->item_size);
+    stats->slab_fragmentation += (double)(cacheP->slab.count - (cacheP->slab.empty ? 1 : 0)) *
+                                 L_CACHE_SLAB_ITEMS (cacheP->item_size) - cacheP->slab.used;
+}
+
+/**
+ * Turns the slab counters summed by _cache_add_stats() into shares of the
+ * slab slots.
+ */
+static void
+_slab_stats (LCacheStats * stats)
+{
+    double slots = stats->slab_occupancy;
+
+    if (slots > 0) {
+        stats->slab_occupancy = stats->slab_items / slots;
+        stats->slab_fragmentation /= slots;
+    }
+}
+
+/**
+ * Fills \e stats with a snapshot of the counters of \e cache. The counters
+ * of a concurrent cache are summed over its partitions, each read under
+ * its lock.
+ *
+ * @param cache The LCache
+ * @param stats where to store the counters
+ */
+void
+l_cache_get_stats(LCache ** cache, LCacheStats * stats)
 {
-    LHash * storage;  /**< the table of lists in which the keys/values are stored */
-    int length;
-    int object_ttl;   /**< cache elemant time-to-live */
-    int cleanup_delay;
-    pthread_t lru_tid;
-};
+    LCacheP cacheP = *cache;
+    int i;
 
-struct _LCacheItem
+    memset(stats, 0, sizeof (LCacheStats));
+    if (NULL == cacheP->shards) {
+        _cache_add_stats(cacheP, stats);
+        _slab_stats(stats);
+        return;
+    }
+    for (i = 0; i < (1 << cacheP->shard_bits); i++) {
+        pthread_mutex_lock(&cacheP->shards[i]->lock);
+        _cache_add_stats(cacheP->shards[i], stats);
+        pthread_mutex_unlock(&cacheP->shards[i]->lock);
+    }
+    _slab_stats(stats);
+    for (i = 0; cacheP->read_counters && i < L_CACHE_READ_STRIPES; i++) {
+        stats->hits += __atomic_load_n(&cacheP->read_counters[i].hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&cacheP->read_counters[i].misses, __ATOMIC_RELAXED);
+    }
+    if (cacheP->front.slots) {
+        LCacheFront * front;
+
+        pthread_mutex_lock(&cacheP->front.lock);
+        stats->front_hits = cacheP->front.retired_hits;
+        for (front = cacheP->front.tables; front; front = front->next) {
+            stats->front_hits += __atomic_load_n(&front->hits, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&cacheP->front.lock);
+    }
+}
+
+/**
+ * Returns the value stored for \e key without counting an access.
+ */
+static lpointer
+_cache_peek (LCacheP cache, lconstpointer key, uint64_t hash)
 {
-    lpointer value;
-    time_t last_accessed;
-};
+    LCacheItemP item;
 
-typedef struct _LCacheItem LCacheItem;
-typedef struct _LCacheItem* LCacheItemP;
-typedef struct _LCache* LCacheP;
-typedef void * (*ThreadProc) (void * arg);
-//extern void _l_hash_dump(LHash * hash);
+    if (cache->plru.sets) {
+        LCachePlruSet * set = _plru_set(cache, hash);
+        int way = _plru_find(set, _plru_tag(hash), key);
+        if (way < 0 || (cache->expire_batch > 0 && cache->object_ttl > 0 &&
+                        (int)(_plru_stamp(cache) - set->stamps[way]) >= cache->object_ttl)) {
+            return NULL;
+        }
+        return set->ways[way].value;
+    }
+    item = _storage_lookup(cache, key, hash);
+    if (NULL == item || (cache->expire_batch > 0 && _cache_item_expired(cache, item))) {
+        return NULL;
+    }
+    return item->value;
+}
 
-sem_t _gCleanupSem;
-char *_gEvent = NULL;
-void *_gData = NULL;
-static pthread_t _gEventTID = 0;
-static bool keep_going = true;
+/* refresh-ahead: l_cache_get_or_put() serves a value that is getting old
+ * and queues its reload to the worker pool of the cache. A value is due
+ * once older than refresh_ahead * ttl, or earlier at random as in XFetch:
+ * when age - beta * cost * ln(random) reaches the ttl, so that the values
+ * slow to rebuild are reloaded sooner and the reloads of values stored
+ * together spread out */
 
 /**
- * Discards the least recently used items first.
- * - caching objects in memory
- * - object cached expiration (idle time and max life)
- * - cache timeouts
+ * Returns whether the value of \e item should be reloaded now.
  */
 static bool
-_least_recently_used (lpointer key, lpointer value, lpointer user_data)
+_refresh_due (LCacheP cache, LCacheItemP item)
 {
-    bool success = true;
-    time_t now;
+    double age = (double)(int64_t)(_cache_now(cache) - item->stored);
+    double draw;
 
-    time(&now);
-    LCacheP cache = user_data;
-    int ttl = cache->object_ttl;
-    LCacheItemP itemP = value;
-    time_t elapsed = difftime(now, itemP->last_accessed);
-    if (itemP != NULL && (ttl <= elapsed)) {
-        char * k = (char*)key;
-        if ( l_hash_remove(cache->storage, key) ) {
-            cache->length--;
-            fprintf(stdout, "%s: deleteKey: %s\n", __func__, k);
-        }
-        //Thread.yield();
+    if (0 == item->ttl) {
+        return false;
     }
-    return success;
+    if (cache->refresh.ahead > 0.0 && age >= cache->refresh.ahead * item->ttl) {
+        return true;
+    }
+    if (cache->refresh.beta <= 0.0) {
+        return false;
+    }
+    /* uniform in (0, 1], the cost is in microseconds */
+    draw = ((_xorshift(&cache->refresh.seed) >> 11) + 1) * 0x1.0p-53;
+    return age - cache->refresh.beta * item->cost / 1e3 * log(draw) >= item->ttl;
 }
 
+/**
+ * Queues the reload of \e key, of \e hash, found in the partition \e part
+ * of \e cache, if it is due and not queued yet.
+ */
 static void
-_cache_checker_thread(void *data)
+_refresh_schedule (LCacheP cache, LCacheP part, lpointer key, uint64_t hash,
+                   LCacheObjectCreator creator)
 {
-    LCacheP cache = data;
-    sem_init(&_gCleanupSem, 0,0);
-
-    // setPriority(Thread.MIN_PRIORITY);
-    while (keep_going) {
-        // cleanup_delay
-        sleep(cache->cleanup_delay);
+    LCacheItemP item = _storage_lookup(part, key, hash);
+    LCacheRefresh * task;
+    size_t length;
 
-        // TODO: critical section: possibly needed to lock if LCache is not thread-safe?
-        l_hash_foreach(cache->storage, _least_recently_used, cache);
+    if (NULL == item || item->refreshing || !_refresh_due(part, item)) {
+        return;
     }
+    /* a copied key may be gone by the time the reload runs: keep its bytes
+     * after the task */
+    length = part->keys.type == L_CACHE_KEY_STRING_COPY || part->keys.type == L_CACHE_KEY_BINARY ?
+             _key_length(part, key) : 0;
+    task = l_calloc (sizeof (LCacheRefresh) + length, 1);
+    if (NULL == task) {
+        return;
+    }
+    task->key = length ? memcpy(task + 1, key, length) : key;
+    task->creator = creator;
+    item->refreshing = 1;
 
-    sem_destroy(&_gCleanupSem);
-    return;
+    pthread_mutex_lock(&cache->refresh.lock);
+    *cache->refresh.tail = task;
+    cache->refresh.tail = &task->next;
+    pthread_cond_signal(&cache->refresh.wake);
+    pthread_mutex_unlock(&cache->refresh.lock);
 }
 
+/**
+ * Reloads the value of a queued key, unless it left the cache meanwhile.
+ * A NULL result keeps the current value until it expires.
+ */
 static void
-del_value (lpointer data)
+_refresh_run (LCacheP cache, LCacheRefresh * task)
 {
-    l_free(data);
-    data = NULL;
+    uint64_t hash = _cache_hash(cache, task->key);
+    struct timespec start, end;
+    LCacheP part;
+    LCacheItemP item;
+    lpointer value;
+    double cost;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    value = task->creator(task->key);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cost = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+    part = _cache_acquire(cache, hash);
+    part->loads++;
+    part->load_time += cost;
+    item = _storage_lookup(part, task->key, hash);
+    if (NULL != item) {
+        if (NULL != value) {
+            __atomic_store_n(&item->value, value, __ATOMIC_RELEASE);
+            item->cost = cost;
+            item->stored = _cache_now(part);
+            part->refreshes++;
+            _front_invalidate(part);
+        }
+        item->refreshing = 0;
+    }
+    _cache_release(part);
 }
 
-/**
- * Creates a new LCache object with integers for keys and values.
- *
- * @see l_hash_new_full()
- *
- * @returns a new LCache object.
- */
+static void *
+_refresh_thread (void * data)
+{
+    LCacheP cache = data;
+    LCacheRefresh * task;
 
-LCache * l_cache_new (LCache ** cache, int ttl, int cleanup) {
-    int rc = 0;
-    pthread_attr_t attr;
-    LCacheP cacheP = l_calloc (sizeof (LCache), 1);
-    if (!cacheP)
-        return NULL;
+    pthread_mutex_lock(&cache->refresh.lock);
+    for (;;) {
+        while (!cache->refresh.stopping && NULL == cache->refresh.queue) {
+            pthread_cond_wait(&cache->refresh.wake, &cache->refresh.lock);
+        }
+        if (cache->refresh.stopping) {
+            break;
+        }
+        task = cache->refresh.queue;
+        cache->refresh.queue = task->next;
+        if (NULL == cache->refresh.queue) {
+            cache->refresh.tail = &cache->refresh.queue;
+        }
+        pthread_mutex_unlock(&cache->refresh.lock);
 
-    *cache = cacheP;
-    cacheP->storage = l_hash_new_full (l_hash_int_hash_func,
-            l_hash_int_equal_func, NULL, del_value);
+        _refresh_run(cache, task);
+        l_free(task);
+        pthread_mutex_lock(&cache->refresh.lock);
+    }
+    pthread_mutex_unlock(&cache->refresh.lock);
+    return NULL;
+}
 
-    if (!cacheP->storage) {
-        l_free (cacheP);
-        return NULL;
+/**
+ * Starts the \e workers reload threads of \e cache.
+ */
+static bool
+_refresh_start (LCacheP cache, int workers)
+{
+    pthread_mutex_init(&cache->refresh.lock, NULL);
+    pthread_cond_init(&cache->refresh.wake, NULL);
+    cache->refresh.tail = &cache->refresh.queue;
+    cache->refresh.threads = l_calloc (sizeof (pthread_t), workers);
+    if (NULL == cache->refresh.threads) {
+        return false;
     }
-    cacheP->object_ttl = ttl;
-    cacheP->cleanup_delay = cleanup;
+    for (; cache->refresh.count < workers; cache->refresh.count++) {
+        if (pthread_create(&cache->refresh.threads[cache->refresh.count], NULL,
+                           _refresh_thread, cache)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    /* start thread */
-    rc = pthread_attr_init(&attr);
-    if (rc) {
-        fprintf(stderr, "[cache] event dispatch thread init failed!\n");
-        return cacheP;
+/**
+ * Stops the reload threads of \e cache, letting the reloads in progress
+ * complete, and drops the queued ones.
+ */
+static void
+_refresh_stop (LCacheP cache)
+{
+    LCacheRefresh * task;
+    int i;
+
+    if (NULL == cache->refresh.tail) {
+        return;
+    }
+    pthread_mutex_lock(&cache->refresh.lock);
+    cache->refresh.stopping = true;
+    pthread_cond_broadcast(&cache->refresh.wake);
+    pthread_mutex_unlock(&cache->refresh.lock);
+    for (i = 0; i < cache->refresh.count; i++) {
+        pthread_join(cache->refresh.threads[i], NULL);
+    }
+    while (NULL != (task = cache->refresh.queue)) {
+        cache->refresh.queue = task->next;
+        l_free(task);
     }
+    l_free(cache->refresh.threads);
+    cache->refresh.threads = NULL;
+    cache->refresh.count = 0;
+    cache->refresh.tail = NULL;
+    pthread_cond_destroy(&cache->refresh.wake);
+    pthread_mutex_destroy(&cache->refresh.lock);
+}
 
-    if (NULL == getenv("LCACHE_NO_THREAD")) {
-        do {
-            rc = pthread_create(&_gEventTID, &attr,
-                                (void *)_cache_checker_thread,
-                                (void *)cacheP);
+static LCacheFlight *
+_flight_find (LCacheP cache, lconstpointer key)
+{
+    LCacheFlight * flight = cache->flights;
 
-        } while (rc != 0 && errno == EINTR);
+    while (flight && !_key_equal(cache, flight->key, key)) {
+        flight = flight->next;
     }
+    return flight;
+}
 
-    if (rc) {
-        fprintf(stderr, "[cache] event dispatch thread create failed!\n");
+/**
+ * Registers the load of \e key by the calling thread, or returns NULL if
+ * out of memory.
+ */
+static LCacheFlight *
+_flight_begin (LCacheP cache, lpointer key)
+{
+    LCacheFlight * flight = l_calloc (sizeof (LCacheFlight), 1);
+
+    if (NULL == flight) {
+        return NULL;
     }
-    pthread_attr_destroy(&attr);
+    flight->key = key;
+    pthread_cond_init(&flight->done_cond, NULL);
+    flight->next = cache->flights;
+    cache->flights = flight;
+    return flight;
+}
 
-//    keep_going = false;
-    fprintf(stderr, "tanch@%s: cache->storage: %p\n", __func__, cacheP->storage);
-    sleep(1);
-    sem_post(&_gCleanupSem);
+static void
+_flight_free (LCacheFlight * flight)
+{
+    pthread_cond_destroy(&flight->done_cond);
+    l_free(flight);
+}
 
-//    pthread_join(_gEventTID, NULL);
-    return cacheP;
+/**
+ * Registers the calling thread for the result of \e flight, which stays
+ * allocated until _flight_result() is called.
+ */
+static void
+_flight_join (LCacheP cache, LCacheFlight * flight)
+{
+    flight->waiters++;
+    cache->coalesced++;
 }
 
 /**
- * Insert a new key/value pair into \e cache.
- *
- * Inserting a key that already exists in the cache will result in that
- * key/value pair being overwritten.
- *
- * @param hash the hash into which \e key and \e value should be inserted.
- * @param key the key to insert
- * @param value the value to insert
- * @return FALSE if out of memory. Otherwise return TRUE
+ * Waits for a joined \e flight to end and returns its result.
  */
-bool
-l_cache_put (LCache ** cache, lpointer key, lpointer value)
+static lpointer
+_flight_result (LCacheP cache, LCacheFlight * flight)
 {
-    bool ret = false;
-    LCacheItemP itemP = l_calloc (sizeof (LCacheItem), 1);
-    if (NULL != itemP) {
-        itemP->value = value;
-        time (&itemP->last_accessed);
-        ret = l_hash_insert((*cache)->storage, key, itemP);
-        if (ret) (*cache)->length++;
+    lpointer value;
+
+    while (!flight->done) {
+        pthread_cond_wait(&flight->done_cond, &cache->lock);
+    }
+    value = flight->value;
+    if (--flight->waiters == 0) {
+        _flight_free(flight);
+    }
+    return value;
+}
+
+/**
+ * Waits for the load of another thread and returns its result.
+ */
+static lpointer
+_flight_wait (LCacheP cache, LCacheFlight * flight)
+{
+    _flight_join(cache, flight);
+    return _flight_result(cache, flight);
+}
+
+/**
+ * Hands \e value to the threads waiting for \e flight; the last one out
+ * frees it.
+ */
+static void
+_flight_end (LCacheP cache, LCacheFlight * flight, lpointer value)
+{
+    LCacheFlight ** link = &cache->flights;
+
+    while (*link != flight) {
+        link = &(*link)->next;
+    }
+    *link = flight->next;
+    flight->value = value;
+    flight->done = true;
+    if (flight->waiters == 0) {
+        _flight_free(flight);
+    } else {
+        pthread_cond_broadcast(&flight->done_cond);
     }
-    return ret;
 }
 
 /**
@@ -209,55 +5194,373 @@ l_cache_put (LCache ** cache, lpointer key, lpointer value)
  *
  * @returns the value associated with \e key in \e hash or NULL if no matching
  * key was found.
+ *
+ * On a miss, the time spent by \e creator becomes the cost of the new item,
+ * see l_cache_put_with_cost(). A NULL returned by \e creator is cached like
+ * any other value, but reads as a miss and is loaded again. A concurrent cache does not hold any lock while \e creator runs, and
+ * only runs one creator at a time per key: the other callers missing the
+ * same key wait for its result, NULL included.
+ *
+ * With refresh-ahead, a hit on a value due for reload returns it at once
+ * and queues the reload to the worker pool; only the misses wait for
+ * \e creator. These lookups take the partition lock.
  */
 lpointer
-l_cache_get (LCache ** cache,
-               lconstpointer key)
+l_cache_get_or_put (LCache ** cache,
+        lpointer key,
+        LCacheObjectCreator creator)
 {
-    lpointer value = NULL;
-    LCacheItemP pitem = (LCacheItemP)l_hash_lookup((*cache)->storage, key);
-    if (NULL != pitem) {
-        time (&pitem->last_accessed);
-        value = pitem->value;
+    uint64_t hash = _cache_hash(*cache, key);
+    LCacheP cacheP;
+    LCacheFlight * flight = NULL;
+    struct timespec start, end;
+    double cost;
+    lpointer value;
+
+    if ((*cache)->refresh.threads) {
+        cacheP = _cache_acquire(*cache, hash);
+        value = _cache_lookup(cacheP, key, hash);
+        if (NULL != value) {
+            _refresh_schedule(*cache, cacheP, key, hash, creator);
+        }
+        _cache_release(cacheP);
+    } else if ((*cache)->front.slots) {
+        value = _front_get(*cache, key, hash);
+    } else {
+        value = _cache_get(*cache, key, hash);
     }
+    if (NULL != value) {
+        return value;
+    }
+    cacheP = _cache_acquire(*cache, hash);
+    if (cacheP->locked) {
+        /* a load may have completed since the lookup */
+        value = _cache_peek(cacheP, key, hash);
+        if (NULL == value && NULL != (flight = _flight_find(cacheP, key))) {
+            value = _flight_wait(cacheP, flight);
+            _cache_release(cacheP);
+            return value;
+        }
+        if (NULL != value) {
+            _cache_release(cacheP);
+            return value;
+        }
+        flight = _flight_begin(cacheP, key);
+    }
+    _cache_release(cacheP);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    value = creator(key);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cost = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+
+    cacheP = _cache_acquire(*cache, hash);
+    cacheP->loads++;
+    cacheP->load_time += cost;
+    /* the lookup already counted this access */
+    _cache_store(cacheP, key, hash, value, cost, 1, _cache_ttl(cacheP));
+    if (NULL != flight) {
+        _flight_end(cacheP, flight, value);
+    }
+    _cache_release(cacheP);
     return value;
 }
 
+/* batches: the keys are hashed and their buckets prefetched up front,
+ * then handled partition by partition, taking each lock once per group
+ * of L_CACHE_BATCH keys */
+
+/**
+ * Hashes each key of a batch into \e hashes, finds its partition, into
+ * \e parts, and prefetches the bucket the key is looked up in.
+ */
+static void
+_batch_route (LCacheP cache, const lconstpointer * keys, int count, LCacheP * parts,
+              uint64_t * hashes)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        uint64_t hash = hashes[i] = _cache_hash(cache, keys[i]);
+        LCacheP part = cache->shards ? _cache_shard_of(cache, hash) : cache;
+
+        if (part->rcu.buckets) {
+            __builtin_prefetch(&part->rcu.buckets[hash & part->rcu.mask]);
+        } else if (part->flat.table.ctrl) {
+            LCacheFlatTable * table = &part->flat.table;
+
+            __builtin_prefetch(&table->ctrl[((hash >> 7) & (table->mask / L_CACHE_FLAT_GROUP)) *
+                                            L_CACHE_FLAT_GROUP]);
+        } else if (part->plru.sets) {
+            __builtin_prefetch(_plru_set(part, hash));
+        }
+        parts[i] = part;
+    }
+}
+
+static void
+_batch_lock (LCacheP part)
+{
+    if (part->locked) {
+        pthread_mutex_lock(&part->lock);
+    }
+}
+
+static int
+_batch_size (int count, int base)
+{
+    return count - base < L_CACHE_BATCH ? count - base : L_CACHE_BATCH;
+}
+
 /**
- * Return total quantity of objects currently in \e cache.
- * Note, that stale (see options) items are returned as part of this item count.
+ * Looks up a batch of at most L_CACHE_BATCH keys routed by _batch_route(),
+ * taking each partition lock once. Clears \e parts.
+ */
+static int
+_batch_get (LCacheP cache, const lconstpointer * keys, lpointer * values, int count,
+            LCacheP * parts, const uint64_t * hashes)
+{
+    int i, j, found = 0;
+
+    if (cache->read_counters) {
+        for (j = 0; j < count; j++) {
+            values[j] = _cache_read(cache, keys[j], hashes[j]);
+            found += NULL != values[j];
+        }
+        return found;
+    }
+    for (i = 0; i < count; i++) {
+        LCacheP part = parts[i];
+
+        if (NULL == part) {
+            continue;
+        }
+        _batch_lock(part);
+        for (j = i; j < count; j++) {
+            if (parts[j] == part) {
+                values[j] = _cache_lookup(part, keys[j], hashes[j]);
+                found += NULL != values[j];
+                parts[j] = NULL;
+            }
+        }
+        _cache_release(part);
+    }
+    return found;
+}
+
+/**
+ * Looks up \e count keys at once, like as many l_cache_get() calls.
  *
  * @param cache The LCache
+ * @param keys the keys to look for
+ * @param values filled with the value of each key, NULL if not found
+ * @param count the number of keys
  *
- * @returns cached items count.
+ * @returns the number of keys found.
  */
 int
-l_cache_get_length(LCache ** cache)
+l_cache_get_many (LCache ** cache, lconstpointer * keys, lpointer * values, int count)
 {
-    return (*cache)->length;
+    LCacheP parts[L_CACHE_BATCH];
+    uint64_t hashes[L_CACHE_BATCH];
+    int base, n, found = 0;
+
+    for (base = 0; base < count; base += n) {
+        n = _batch_size(count, base);
+        _batch_route(*cache, keys + base, n, parts, hashes);
+        found += _batch_get(*cache, keys + base, values + base, n, parts, hashes);
+    }
+    return found;
 }
 
 /**
- * Search \e hash for \e key returning the associated value if \e key is
- * found, NULL otherwise.
+ * Inserts \e count key/value pairs at once, like as many l_cache_put()
+ * calls.
  *
- * @param hash the hash in which to look for \e key
- * @param key the key to look for in \e hash.
+ * @param cache The LCache
+ * @param keys the keys to insert
+ * @param values the value of each key
+ * @param count the number of pairs
  *
- * @returns the value associated with \e key in \e hash or NULL if no matching
- * key was found.
+ * @returns the number of pairs stored, less than \e count if out of memory.
  */
-lpointer
-l_cache_get_or_put (LCache ** cache,
-        lpointer key,
-        LCacheObjectCreator creator)
+int
+l_cache_put_many (LCache ** cache, lpointer * keys, lpointer * values, int count)
 {
-    lpointer value = l_cache_get(cache, key);
-    if (NULL == value) {
-        value = creator(key);
-        l_cache_put(cache, key, value);
+    LCacheP parts[L_CACHE_BATCH];
+    uint64_t hashes[L_CACHE_BATCH];
+    int base, i, j, n, stored = 0;
+
+    for (base = 0; base < count; base += n) {
+        n = _batch_size(count, base);
+        _batch_route(*cache, (const lconstpointer *) keys + base, n, parts, hashes);
+        for (i = 0; i < n; i++) {
+            LCacheP part = parts[i];
+
+            if (NULL == part) {
+                continue;
+            }
+            _batch_lock(part);
+            for (j = i; j < n; j++) {
+                if (parts[j] != part) {
+                    continue;
+                }
+                if (part->admission.sketch.table) {
+                    _sketch_record(&part->admission.sketch, hashes[j]);
+                }
+                stored += _cache_store(part, keys[base + j], hashes[j], values[base + j], 1.0, 1,
+                                       _cache_ttl(part));
+                parts[j] = NULL;
+            }
+            _cache_release(part);
+        }
     }
-    return value;
+    return stored;
+}
+
+/**
+ * Loads the misses of a batch of at most L_CACHE_BATCH keys with one
+ * \e creator call. The keys another thread is loading are joined, and
+ * waited for once the loads of this batch are published, so that two
+ * batches never wait for each other.
+ */
+static int
+_batch_load (LCache ** cache, lpointer * keys, lpointer * values, int count,
+             LCacheBatchCreator creator)
+{
+    LCacheP parts[L_CACHE_BATCH];
+    uint64_t hashes[L_CACHE_BATCH];
+    LCacheP pending[L_CACHE_BATCH];
+    LCacheFlight * flights[L_CACHE_BATCH];
+    bool waits[L_CACHE_BATCH];
+    lpointer missing[L_CACHE_BATCH];
+    lpointer loaded[L_CACHE_BATCH];
+    int slots[L_CACHE_BATCH];
+    struct timespec start, end;
+    double cost;
+    int i, j, k, misses = 0, found;
+
+    _batch_route(*cache, (const lconstpointer *) keys, count, parts, hashes);
+    memcpy(pending, parts, count * sizeof (LCacheP));
+    found = _batch_get(*cache, (const lconstpointer *) keys, values, count, pending, hashes);
+    if (found == count) {
+        return found;
+    }
+    for (j = 0; j < count; j++) {
+        pending[j] = values[j] ? NULL : parts[j];
+        flights[j] = NULL;
+        waits[j] = false;
+    }
+    /* claims the misses nobody loads yet */
+    for (i = 0; i < count; i++) {
+        LCacheP part = pending[i];
+
+        if (NULL == part) {
+            continue;
+        }
+        _batch_lock(part);
+        for (j = i; j < count; j++) {
+            if (pending[j] != part) {
+                continue;
+            }
+            pending[j] = NULL;
+            if (part->locked) {
+                /* a load may have completed since the lookup */
+                if (NULL != (values[j] = _cache_peek(part, keys[j], hashes[j]))) {
+                    found++;
+                    continue;
+                }
+                if (NULL != (flights[j] = _flight_find(part, keys[j]))) {
+                    _flight_join(part, flights[j]);
+                    waits[j] = true;
+                    continue;
+                }
+                flights[j] = _flight_begin(part, keys[j]);
+            }
+            missing[misses] = keys[j];
+            loaded[misses] = NULL;
+            slots[misses++] = j;
+        }
+        _cache_release(part);
+    }
+
+    if (misses > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        creator((lconstpointer *) missing, loaded, misses);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        cost = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / misses;
+
+        for (k = 0; k < misses; k++) {
+            pending[k] = parts[slots[k]];
+        }
+        for (i = 0; i < misses; i++) {
+            LCacheP part = pending[i];
+
+            if (NULL == part) {
+                continue;
+            }
+            _batch_lock(part);
+            for (k = i; k < misses; k++) {
+                if (pending[k] != part) {
+                    continue;
+                }
+                pending[k] = NULL;
+                j = slots[k];
+                part->loads++;
+                part->load_time += cost;
+                if (NULL != loaded[k]) {
+                    /* the lookup already counted this access */
+                    _cache_store(part, keys[j], hashes[j], loaded[k], cost, 1, _cache_ttl(part));
+                    found++;
+                }
+                if (NULL != flights[j]) {
+                    _flight_end(part, flights[j], loaded[k]);
+                }
+                values[j] = loaded[k];
+            }
+            _cache_release(part);
+        }
+    }
+
+    for (j = 0; j < count; j++) {
+        if (waits[j]) {
+            _batch_lock(parts[j]);
+            values[j] = _flight_result(parts[j], flights[j]);
+            found += NULL != values[j];
+            _cache_release(parts[j]);
+        }
+    }
+    return found;
+}
+
+/**
+ * Looks up \e count keys at once and loads all the misses with a single
+ * \e creator call, or one per group of 256 keys, like as many
+ * l_cache_get_or_put() calls. The time spent by \e creator is shared
+ * among the keys it was given; the keys another thread is loading are
+ * waited for instead. Unlike with l_cache_get_or_put(), the keys left NULL
+ * by \e creator are not cached.
+ *
+ * @param cache The LCache
+ * @param keys the keys to look for
+ * @param values filled with the value of each key, NULL if neither found
+ * nor built by \e creator
+ * @param count the number of keys
+ * @param creator fills the values of the missing keys
+ *
+ * @returns the number of values found or built.
+ */
+int
+l_cache_get_or_put_many (LCache ** cache, lpointer * keys, lpointer * values, int count,
+                         LCacheBatchCreator creator)
+{
+    int base, n, found = 0;
+
+    for (base = 0; base < count; base += n) {
+        n = _batch_size(count, base);
+        found += _batch_load(cache, keys + base, values + base, n, creator);
+    }
+    return found;
 }
 
 
@@ -272,31 +5575,44 @@ dumpCacheItem (lpointer key, lpointer value, lpointer user_data)
     return false;
 }
 
+static void
+_cache_dump (LCacheP cache)
+{
+    fprintf(stderr, "tanch@%s: cache->storage: %p\n",
+            __func__, cache->storage);
+    if (NULL == cache->plru.sets) {
+        _storage_foreach(cache, dumpCacheItem, cache);
+    }
+}
+
 void
 l_cache_dump (LCache ** cache)
 {
+    int i;
+
     fprintf(stderr, "tanch@%s: cache: %p \n", __func__, *cache );
-    if ( *cache ) {
-        fprintf(stderr, "tanch@%s: cache->storage: %p\n",
-                __func__, (*cache)->storage);
-        l_hash_foreach((*cache)->storage, dumpCacheItem, cache);
+    if ( NULL == *cache ) {
+        return;
+    }
+    if (NULL == (*cache)->shards) {
+        _cache_dump(*cache);
+        return;
+    }
+    for (i = 0; i < (1 << (*cache)->shard_bits); i++) {
+        pthread_mutex_lock(&(*cache)->shards[i]->lock);
+        _cache_dump((*cache)->shards[i]);
+        pthread_mutex_unlock(&(*cache)->shards[i]->lock);
     }
 }
 
 void
 l_cache_destroy (LCache ** cache)
 {
-    /* Stop the main loop in the cleanup thread. */
-    keep_going = false;
-
-    if (_gEventTID) {
-        sem_post(&_gCleanupSem);
-        sleep(2);
-        pthread_cancel(_gEventTID);
-    }
     if (*cache) {
-        l_hash_destroy((*cache)->storage);
-        l_free (*cache);
+        /* Stop the main loop in the cleanup thread. */
+        _refresh_stop(*cache);
+        _cleaner_stop(*cache);
+        _cache_free(*cache);
     }
     *cache = NULL;
 }
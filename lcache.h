@@ -65,11 +65,130 @@ typedef enum
                          * Combines Adaptive Replacement Cache (ARC) and CLOCK. CAR has performance comparable to ARC, and substantially
                          * outperforms both LRU and CLOCK. Like ARC, CAR is self-tuning and requires no user-specified magic parameters.
  */
+    L_CACHE_GDSF,   /**< GreedyDual-Size-Frequency (GDSF)
+                         * Discards the item of least priority, the access count times the cost of rebuilding the item
+                         * divided by its size, plus the priority of the previous victim so that idle items age out.
+                         * The cost is the time spent by the l_cache_get_or_put() creator, or the one given to
+                         * l_cache_put_with_cost(). */
 } LCacheType;
 
+/** How keys are hashed, compared and kept by the cache */
+typedef enum
+{
+    L_CACHE_KEY_INT,            /**< integers or pointers, compared by identity */
+    L_CACHE_KEY_STRING,         /**< NUL terminated strings compared by content, borrowed: each
+                                     must outlive its item */
+    L_CACHE_KEY_STRING_COPY,    /**< NUL terminated strings compared by content, copied by the
+                                     cache; up to 32 bytes are kept in the item itself */
+    L_CACHE_KEY_BINARY,         /**< \e key_size bytes compared by content, copied like
+                                     L_CACHE_KEY_STRING_COPY */
+} LCacheKeyType;
+
 /* types */
 /* Callback Functions */
 typedef lpointer (*LCacheObjectCreator) (lconstpointer key);
+/** Returns the size of \e value in bytes, see LCacheOptions.max_weight */
+typedef size_t (*LCacheWeigher) (lconstpointer key, lconstpointer value);
+/** Fills \e values with the value of each of the \e count \e keys, NULL for those not found */
+typedef void (*LCacheBatchCreator) (lconstpointer * keys, lpointer * values, int count);
+
+/** Cache construction options, see l_cache_options_init() for the defaults. */
+typedef struct _LCacheOptions
+{
+    LCacheType type;            /**< replacement policy */
+    int capacity;               /**< maximum number of items, 0 for an unbounded cache */
+    int ttl;                    /**< item time-to-live in seconds since the last access, on the
+                                     monotonic clock; 0 leaves expiration to l_cache_put_with_ttl() */
+    int cleanup;                /**< seconds between expiration sweeps, 0 disables the sweep thread;
+                                     the swept cache is locked like a single partition at least */
+    double protected_ratio;     /**< L_CACHE_SLRU: share of \e capacity reserved for the protected segment */
+    double hir_ratio;           /**< L_CACHE_LIRS: share of \e capacity left to resident HIR blocks */
+    bool admission;             /**< W-TinyLFU admission in front of the LRU, MRU, SLRU, LFU or LIRS policy */
+    double admission_window;    /**< share of \e capacity given to the admission window */
+    int eviction_samples;       /**< L_CACHE_LRU: evict the oldest of this many random items, and of
+                                     the best candidates of the previous evictions, instead of keeping
+                                     an exact recency list; 0 keeps the list */
+    int shards;                 /**< 0 for an unsynchronized cache, or a power of two number of
+                                     partitions selected by key hash, each with its own lock,
+                                     policy and share of \e capacity */
+    bool lock_free_reads;       /**< with \e shards, l_cache_get() takes no lock and removed items are
+                                     freed once no reader can hold them; for L_CACHE_CAR, L_CACHE_RR
+                                     and sampled L_CACHE_LRU, without admission */
+    bool flat_storage;          /**< items filed in an open addressing table probed 16 slots at a time
+                                     and reused after removal, instead of an LHash; L_CACHE_PLRU
+                                     always stores its items in place. A full table is replaced by a
+                                     larger one, the items moving a few at a time over the next
+                                     operations */
+    int size_hint;              /**< items the flat table or the lock-free buckets are sized for at
+                                     creation when more than \e capacity, so that they do not grow;
+                                     the LHash storage sizes itself */
+    bool item_slabs;            /**< items carved from 16 KB slabs of the cache, each released once
+                                     its last item is, rather than allocated one by one */
+    LCacheWeigher weigher;      /**< weight of a value, NULL to use the size given to
+                                     l_cache_put_with_cost(), 1 for l_cache_put() */
+    size_t max_weight;          /**< byte budget: the policy evicts until the summed weight of the
+                                     items, plus the bytes each item costs the cache, fits; 0 for
+                                     no budget. L_CACHE_LRU, MRU, SLRU, LFU, RR and GDSF, without
+                                     admission */
+    LCacheKeyType key_type;     /**< content keys are hashed with wyhash and stored in the flat
+                                     table or the lock-free buckets; not for L_CACHE_PLRU or front
+                                     caches */
+    size_t key_size;            /**< L_CACHE_KEY_BINARY: bytes of a key */
+    int expire_batch;           /**< thread-free expiration: l_cache_get() drops expired items, and each
+                                     insertion expires or reschedules at most this many; 0 disables */
+    double refresh_ahead;       /**< with \e shards and \e ttl, l_cache_get_or_put() returns a value stored
+                                     longer than this share of \e ttl ago and reloads it in the
+                                     background; 0 disables */
+    double refresh_beta;        /**< XFetch early reloads: a value is also reloaded when its age minus
+                                     beta * its rebuild time * ln(random) reaches \e ttl; 0 disables */
+    int refresh_workers;        /**< threads running the background reloads, 0 for one */
+    int front_slots;            /**< with \e shards, a power of two number of slots of the thread-local
+                                     direct-mapped table l_cache_get() tries first; 0 disables */
+    int front_promotion;        /**< shared hits in a row copying a value to the front table */
+    int clock_resolution;       /**< milliseconds between the updates of a cached clock by the timer
+                                     thread, read by the operations instead of the system clock;
+                                     0 reads the system clock */
+} LCacheOptions;
+
+/** A snapshot of the cache counters, see l_cache_get_stats(). */
+typedef struct _LCacheStats
+{
+    int length;                 /**< items currently stored */
+    int capacity;               /**< maximum number of items, 0 when unbounded */
+    size_t weight;              /**< summed weight of the items, see l_cache_get_weight() */
+    size_t max_weight;          /**< weight budget, 0 when unbounded */
+    unsigned long hits;         /**< lookups that found their key */
+    unsigned long misses;       /**< lookups that did not */
+    unsigned long evictions;    /**< items dropped by the replacement policy */
+    int probationary_length;    /**< L_CACHE_SLRU: items in the probationary segment, T1 for L_CACHE_ARC/CAR,
+                                     resident HIR blocks for L_CACHE_LIRS */
+    int protected_length;       /**< L_CACHE_SLRU: items in the protected segment, T2 for L_CACHE_ARC/CAR,
+                                     LIR blocks for L_CACHE_LIRS */
+    int ghost_length;           /**< L_CACHE_ARC/CAR: evicted key hashes remembered in B1 and B2,
+                                     non-resident HIR blocks for L_CACHE_LIRS */
+    size_t ghost_bytes;         /**< L_CACHE_ARC/CAR/LIRS: memory reserved for the ghost entries */
+    int adaptive_target;        /**< L_CACHE_ARC/CAR: current target size of T1 */
+    int window_length;          /**< items in the admission window */
+    unsigned long admission_rejections; /**< window evictions found less popular than the policy victim */
+    double evicted_cost;        /**< summed cost of the evicted items, see l_cache_put_with_cost() */
+    unsigned long loads;        /**< values built by the l_cache_get_or_put() creator */
+    double load_time;           /**< microseconds spent in the creator */
+    unsigned long coalesced_loads;  /**< l_cache_get_or_put() misses served by the creator call of
+                                         another thread */
+    unsigned long refreshes;    /**< values reloaded in the background by refresh-ahead */
+    unsigned long front_hits;   /**< l_cache_get() calls served by a thread-local front table, not
+                                     counted in \e hits */
+    unsigned long expirations;  /**< items dropped for their time-to-live */
+    double expire_time_max;     /**< longest expiration step run by an insertion, in microseconds */
+    double inflation;           /**< L_CACHE_GDSF: priority of the last victim */
+    size_t slab_bytes;          /**< memory held by the item slabs */
+    int slab_items;             /**< items allocated from the slabs */
+    double slab_occupancy;      /**< share of the slab slots holding an item */
+    double slab_fragmentation;  /**< share of the slab slots free in slabs that still hold an item,
+                                     which cannot be released */
+    unsigned long resizes;      /**< flat tables replaced by a larger one, or by one without
+                                     DELETED markers */
+} LCacheStats;
 
 /** An opaque cache object container */
 typedef struct _LCache LCache;
@@ -78,13 +197,24 @@ typedef struct _Thread Thread;
 /* cache methods */
 
 LCache * l_cache_new (LCache ** cache, int ttl, int cleanup);
+LCache * l_cache_new_full (LCache ** cache, LCacheType type, int capacity, int ttl, int cleanup);
+LCache * l_cache_new_with_options (LCache ** cache, const LCacheOptions * options);
+void l_cache_options_init (LCacheOptions * options);
 void l_cache_destroy (LCache ** cache);
 
 bool l_cache_put (LCache ** cache, lpointer key, lpointer value);
+bool l_cache_put_with_cost (LCache ** cache, lpointer key, lpointer value, double cost, size_t size);
+bool l_cache_put_with_ttl (LCache ** cache, lpointer key, lpointer value, unsigned int ttl);
 lpointer l_cache_get (LCache ** cache, lconstpointer key);
 lpointer l_cache_get_or_put (LCache ** cache, lpointer key, LCacheObjectCreator creator);
+int l_cache_get_many (LCache ** cache, lconstpointer * keys, lpointer * values, int count);
+int l_cache_put_many (LCache ** cache, lpointer * keys, lpointer * values, int count);
+int l_cache_get_or_put_many (LCache ** cache, lpointer * keys, lpointer * values, int count,
+                             LCacheBatchCreator creator);
 
 int l_cache_get_length(LCache ** cache);
+size_t l_cache_get_weight(LCache ** cache);
+void l_cache_get_stats(LCache ** cache, LCacheStats * stats);
 void l_cache_dump(LCache ** cache);
 
 /* helper funcs */
@@ -32,6 +32,7 @@ TEST_LDEBUG := $d/test_ldebug
 TEST_LSTACK := $d/test_lstack
 TEST_LCACHE := $d/test_lcache
 BENCH_LNAME := $d/bench_lname
+BENCH_LCACHE := $d/bench_lcache
 
 #
 # TEST_PROGRAMS - programs to be built in the test dir
@@ -59,6 +60,7 @@ TEST_PROGRAMS += $(TEST_LVALUE)
 TEST_PROGRAMS += $(TEST_LDEBUG)
 
 TEST_PROGRAMS += $(BENCH_LNAME)
+TEST_PROGRAMS += $(BENCH_LCACHE)
 
 
 # these runtime path things are stolen from perl's makefiles, so we don't
@@ -86,7 +88,7 @@ CLEANFILES += $(TEST_PROGRAMS) $(TEST_OBJECTS)
 #    same as TEST_PROGRAMS.
 #
 #TESTS = $(TEST_PROGRAMS)
-DONT_RUN = $(BENCH_LNAME)
+DONT_RUN = $(BENCH_LNAME) $(BENCH_LCACHE)
 ifneq ($(strip $(CROSS_COMPILE)),)
 DONT_RUN += $(TEST_LTHREAD) # qemu doesn't handle threads in process mode
 endif
@@ -0,0 +1,136 @@
+/* -*- mode: c; indent-tabs-mode: nil; c-basic-offset: 4; -*- */
+/* vim: set expandtab shiftwidth=4 softtabstop=4 : */
+/*
+ * Compares the storage engines of LCache, with and without item slabs: an
+ * unbounded cache filled with \e capacity items, which shows the worst put
+ * stalled by a resize, a full LRU cache replacing its items, then lookups
+ * of present and missing keys.
+ *
+ * usage: bench_lcache [capacity [operations]]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <llib/lmacros.h>
+#include <llib/lcache.h>
+
+static double
+elapsed_since (const struct timespec * start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint64_t
+next_key (uint64_t * state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int
+bench_growth (const char * name, const LCacheOptions * engine, int capacity)
+{
+    LCache * lc = NULL;
+    LCacheOptions options = *engine;
+    struct timespec start;
+    double total = 0.0, worst = 0.0;
+    int i;
+
+    if (NULL == l_cache_new_with_options(&lc, &options)) {
+        fprintf(stderr, "%s: l_cache_new_with_options failed\n", name);
+        return -1;
+    }
+    for (i = 1; i <= capacity; i++) {
+        double elapsed;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        l_cache_put(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+        elapsed = elapsed_since(&start);
+        total += elapsed;
+        if (elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+    printf("%-6s fill %7.1f ns/op   worst put %9.1f us\n", name,
+           total * 1e9 / capacity, worst * 1e6);
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static int
+bench_storage (const char * name, const LCacheOptions * engine, int capacity, int operations)
+{
+    LCache * lc = NULL;
+    LCacheOptions options = *engine;
+    struct timespec start;
+    uint64_t state = 88172645463325252ULL;
+    unsigned long found = 0;
+    double put_time, get_time;
+    int i;
+
+    options.capacity = capacity;
+    if (NULL == l_cache_new_with_options(&lc, &options)) {
+        fprintf(stderr, "%s: l_cache_new_with_options failed\n", name);
+        return -1;
+    }
+
+    /* twice the capacity in distinct keys: half of the puts evict */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < operations; i++) {
+        uint64_t key = next_key(&state) % (2 * (uint64_t)capacity) + 1;
+        l_cache_put(&lc, L_INT_TO_PTR (key), L_INT_TO_PTR (key));
+    }
+    put_time = elapsed_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < operations; i++) {
+        uint64_t key = next_key(&state) % (2 * (uint64_t)capacity) + 1;
+        found += NULL != l_cache_get(&lc, L_INT_TO_PTR (key));
+    }
+    get_time = elapsed_since(&start);
+
+    printf("%-6s put %7.1f ns/op   get %7.1f ns/op   hit ratio %.2f\n", name,
+           put_time * 1e9 / operations, get_time * 1e9 / operations,
+           (double) found / operations);
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+int
+main (int argc, char * argv[])
+{
+    int capacity = argc > 1 ? atoi(argv[1]) : 100000;
+    int operations = argc > 2 ? atoi(argv[2]) : 2000000;
+    LCacheOptions lhash, flat, slabs;
+
+    if (capacity < 1 || operations < 1) {
+        fprintf(stderr, "usage: %s [capacity [operations]]\n", argv[0]);
+        return 1;
+    }
+    l_cache_options_init(&lhash);
+    flat = lhash;
+    flat.flat_storage = true;
+    slabs = flat;
+    slabs.item_slabs = true;
+
+    printf("capacity %d, %d operations\n", capacity, operations);
+    /* flat first: the items freed by an LHash run make the allocator
+     * consolidate its free lists on the next large allocation */
+    if (bench_growth("flat", &flat, capacity) ||
+        bench_growth("slabs", &slabs, capacity) ||
+        bench_growth("lhash", &lhash, capacity) ||
+        bench_storage("lhash", &lhash, capacity, operations) ||
+        bench_storage("flat", &flat, capacity, operations) ||
+        bench_storage("slabs", &slabs, capacity, operations)) {
+        return 1;
+    }
+    return 0;
+}
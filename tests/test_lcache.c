@@ -11,6 +11,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <time.h>
 #include <llib/lmacros.h>
@@ -146,6 +148,1258 @@ __cyg_profile_func_exit (void *func, void *caller)
  //}
 }
 
+int
+test_l_cache_lru (void)
+{
+    LCache * lru = NULL;
+    int i;
+
+    // bounded to 3 items, no expiration thread.
+    ret_fail_unless (NULL != l_cache_new_full(&lru, L_CACHE_LRU, 3, 0, 0),
+                     "l_cache_new_full failed");
+    for (i = 0; i < 3; i++) {
+        l_cache_put(&lru, key[i], L_INT_TO_PTR (vals[i]));
+    }
+    // touch key1 so key2 becomes the least recently used item.
+    l_cache_get(&lru, key[0]);
+    l_cache_put(&lru, key[3], L_INT_TO_PTR (vals[3]));
+
+    ret_fail_unless (3 == l_cache_get_length(&lru), "LRU capacity exceeded");
+    ret_fail_unless (NULL == l_cache_get(&lru, key[1]), "LRU kept the wrong item");
+    ret_fail_unless (vals[0] == L_PTR_TO_INT (l_cache_get(&lru, key[0])),
+                     "LRU evicted a recently used item");
+    ret_fail_unless (vals[3] == L_PTR_TO_INT (l_cache_get(&lru, key[3])),
+                     "LRU lost the new item");
+
+    // overwriting an existing key must not grow the cache.
+    l_cache_put(&lru, key[3], L_INT_TO_PTR (vals[0]));
+    ret_fail_unless (3 == l_cache_get_length(&lru), "LRU overwrite grew the cache");
+    l_cache_destroy(&lru);
+    return 0;
+}
+
+int
+test_l_cache_slru (void)
+{
+    LCache * slru = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i;
+
+    l_cache_options_init(&options);
+    options.type = L_CACHE_SLRU;
+    options.capacity = 8;
+    options.protected_ratio = 0.5;
+    ret_fail_unless (NULL != l_cache_new_with_options(&slru, &options),
+                     "l_cache_new_with_options failed");
+
+    // a hot working set, hit twice so it gets protected.
+    for (i = 0; i < 4; i++) {
+        l_cache_put(&slru, L_INT_TO_PTR (i + 1), L_INT_TO_PTR (i + 1));
+        l_cache_get(&slru, L_INT_TO_PTR (i + 1));
+    }
+    // a scan of one-hit wonders must stay in probation.
+    for (i = 100; i < 200; i++) {
+        l_cache_put(&slru, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+    }
+    l_cache_get_stats(&slru, &stats);
+    ret_fail_unless (8 == stats.length, "SLRU capacity exceeded");
+    ret_fail_unless (4 == stats.protected_length, "SLRU protected segment not filled");
+    ret_fail_unless (4 == stats.probationary_length, "SLRU scan left probation");
+    for (i = 0; i < 4; i++) {
+        ret_fail_unless (i + 1 == L_PTR_TO_INT (l_cache_get(&slru, L_INT_TO_PTR (i + 1))),
+                         "SLRU scan flushed the working set");
+    }
+    l_cache_destroy(&slru);
+    return 0;
+}
+
+int
+test_l_cache_arc (void)
+{
+    LCache * arc = NULL;
+    LCacheStats stats;
+    int i, target;
+
+    ret_fail_unless (NULL != l_cache_new_full(&arc, L_CACHE_ARC, 8, 0, 0),
+                     "l_cache_new_full failed");
+    for (i = 0; i < 4; i++) {
+        l_cache_put(&arc, L_INT_TO_PTR (i + 1), L_INT_TO_PTR (i + 1));
+        l_cache_get(&arc, L_INT_TO_PTR (i + 1));
+    }
+    for (i = 100; i < 200; i++) {
+        l_cache_put(&arc, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+    }
+    l_cache_get_stats(&arc, &stats);
+    ret_fail_unless (8 == stats.length, "ARC capacity exceeded");
+    ret_fail_unless (4 == stats.protected_length, "ARC lost the frequent items");
+    ret_fail_unless (stats.ghost_length > 0 && stats.ghost_length <= 8,
+                     "ARC ghost lists out of bounds");
+    ret_fail_unless (stats.ghost_bytes > 0, "ARC ghost memory not reported");
+
+    // a key recently evicted from T1 is a ghost hit in B1: T1 must grow.
+    target = stats.adaptive_target;
+    l_cache_put(&arc, L_INT_TO_PTR (195), L_INT_TO_PTR (195));
+    l_cache_get_stats(&arc, &stats);
+    ret_fail_unless (stats.adaptive_target > target, "ARC did not adapt");
+    l_cache_destroy(&arc);
+    return 0;
+}
+
+int
+test_l_cache_car (void)
+{
+    LCache * car = NULL;
+    LCacheStats stats;
+    int i;
+
+    ret_fail_unless (NULL != l_cache_new_full(&car, L_CACHE_CAR, 8, 0, 0),
+                     "l_cache_new_full failed");
+    for (i = 0; i < 4; i++) {
+        l_cache_put(&car, L_INT_TO_PTR (i + 1), L_INT_TO_PTR (i + 1));
+        l_cache_get(&car, L_INT_TO_PTR (i + 1));
+    }
+    for (i = 100; i < 200; i++) {
+        l_cache_put(&car, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+    }
+    l_cache_get_stats(&car, &stats);
+    ret_fail_unless (8 == stats.length, "CAR capacity exceeded");
+    ret_fail_unless (stats.ghost_length <= 8, "CAR ghost lists out of bounds");
+    for (i = 0; i < 4; i++) {
+        ret_fail_unless (i + 1 == L_PTR_TO_INT (l_cache_get(&car, L_INT_TO_PTR (i + 1))),
+                         "CAR scan flushed the referenced items");
+    }
+    l_cache_destroy(&car);
+    return 0;
+}
+
+/* replays a loop over \e keys keys, \e passes times, and returns the hits */
+static int
+replay_loop (LCache ** lc, int keys, int passes)
+{
+    int i, k, hits = 0;
+
+    for (i = 0; i < passes; i++) {
+        for (k = 1; k <= keys; k++) {
+            if (NULL != l_cache_get(lc, L_INT_TO_PTR (k))) {
+                hits++;
+            } else {
+                l_cache_put(lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+            }
+        }
+    }
+    return hits;
+}
+
+int
+test_l_cache_lirs (void)
+{
+    LCache * lru = NULL;
+    LCache * lirs = NULL;
+    LCacheStats stats;
+    int lru_hits, lirs_hits;
+
+    // a loop slightly larger than the cache defeats LRU entirely.
+    ret_fail_unless (NULL != l_cache_new_full(&lru, L_CACHE_LRU, 100, 0, 0),
+                     "l_cache_new_full failed");
+    ret_fail_unless (NULL != l_cache_new_full(&lirs, L_CACHE_LIRS, 100, 0, 0),
+                     "l_cache_new_full failed");
+    lru_hits = replay_loop(&lru, 110, 20);
+    lirs_hits = replay_loop(&lirs, 110, 20);
+    ret_fail_unless (0 == lru_hits, "LRU hit a loop larger than the cache");
+    ret_fail_unless (lirs_hits > lru_hits, "LIRS no better than LRU on a loop");
+    ret_fail_unless (lirs_hits > 110 * 20 / 2, "LIRS hit rate too low on a loop");
+
+    l_cache_get_stats(&lirs, &stats);
+    ret_fail_unless (100 == stats.length, "LIRS capacity exceeded");
+    ret_fail_unless (stats.ghost_length <= 100, "LIRS non-resident blocks out of bounds");
+    l_cache_destroy(&lru);
+    l_cache_destroy(&lirs);
+    return 0;
+}
+
+int
+test_l_cache_lfu (void)
+{
+    LCache * lfu = NULL;
+    int i;
+
+    ret_fail_unless (NULL != l_cache_new_full(&lfu, L_CACHE_LFU, 3, 0, 0),
+                     "l_cache_new_full failed");
+    for (i = 0; i < 3; i++) {
+        l_cache_put(&lfu, key[i], L_INT_TO_PTR (vals[i]));
+    }
+    // key1 used three times, key3 twice, key2 only once.
+    l_cache_get(&lfu, key[0]);
+    l_cache_get(&lfu, key[0]);
+    l_cache_get(&lfu, key[2]);
+    l_cache_put(&lfu, key[3], L_INT_TO_PTR (vals[3]));
+    ret_fail_unless (NULL == l_cache_get(&lfu, key[1]), "LFU kept the least used item");
+    ret_fail_unless (vals[0] == L_PTR_TO_INT (l_cache_get(&lfu, key[0])),
+                     "LFU evicted the most used item");
+
+    // key4 (one use) goes before key3 (two uses).
+    l_cache_put(&lfu, key[1], L_INT_TO_PTR (vals[1]));
+    ret_fail_unless (NULL == l_cache_get(&lfu, key[3]), "LFU ignored the access counts");
+    ret_fail_unless (vals[2] == L_PTR_TO_INT (l_cache_get(&lfu, key[2])),
+                     "LFU evicted a frequent item");
+    l_cache_destroy(&lfu);
+
+    // each sweep halves the counts: key1, used eight times long ago,
+    // loses to key2 and key3 used three times since.
+    ret_fail_unless (NULL != l_cache_new_full(&lfu, L_CACHE_LFU, 3, 0, 1),
+                     "l_cache_new_full failed");
+    for (i = 0; i < 3; i++) {
+        l_cache_put(&lfu, key[i], L_INT_TO_PTR (vals[i]));
+    }
+    for (i = 0; i < 7; i++) {
+        l_cache_get(&lfu, key[0]);
+    }
+    sleep(4);
+    for (i = 0; i < 2; i++) {
+        l_cache_get(&lfu, key[1]);
+        l_cache_get(&lfu, key[2]);
+    }
+    l_cache_put(&lfu, key[3], L_INT_TO_PTR (vals[3]));
+    ret_fail_unless (NULL == l_cache_get(&lfu, key[0]), "LFU counts never aged");
+    ret_fail_unless (vals[1] == L_PTR_TO_INT (l_cache_get(&lfu, key[1])),
+                     "LFU evicted a recently frequent item");
+    l_cache_destroy(&lfu);
+    return 0;
+}
+
+int
+test_l_cache_plru (void)
+{
+    LCache * plru = NULL;
+    LCacheStats stats;
+    int i;
+
+    ret_fail_unless (NULL != l_cache_new_full(&plru, L_CACHE_PLRU, 64, 0, 0),
+                     "l_cache_new_full failed");
+    for (i = 1; i <= 1000; i++) {
+        l_cache_put(&plru, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+        ret_fail_unless (i == L_PTR_TO_INT (l_cache_get(&plru, L_INT_TO_PTR (i))),
+                         "PLRU lost the item just stored");
+    }
+    l_cache_get_stats(&plru, &stats);
+    ret_fail_unless (64 == stats.capacity, "PLRU capacity changed");
+    ret_fail_unless (stats.length <= 64, "PLRU capacity exceeded");
+    ret_fail_unless (1000 == stats.length + stats.evictions, "PLRU lost count of its items");
+    l_cache_destroy(&plru);
+    return 0;
+}
+
+int
+test_l_cache_admission (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i, k;
+
+    l_cache_options_init(&options);
+    options.type = L_CACHE_LRU;
+    options.capacity = 10;
+    options.admission = true;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+
+    // a popular working set filling the LRU part of the cache.
+    for (i = 0; i < 5; i++) {
+        for (k = 1; k < 10; k++) {
+            if (NULL == l_cache_get(&lc, L_INT_TO_PTR (k))) {
+                l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+            }
+        }
+    }
+    // one-hit wonders only go through the window.
+    for (k = 100; k < 200; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (10 == stats.length, "admission window exceeded the capacity");
+    ret_fail_unless (1 == stats.window_length, "admission window not used");
+    ret_fail_unless (stats.admission_rejections > 0, "admission never rejected a scan");
+    for (k = 1; k < 10; k++) {
+        ret_fail_unless (k == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (k))),
+                         "admission let a scan flush the working set");
+    }
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+int
+test_l_cache_sampled (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int k, kept = 0;
+
+    l_cache_options_init(&options);
+    options.type = L_CACHE_LRU;
+    options.capacity = 100;
+    options.eviction_samples = 5;
+    options.clock_resolution = 200;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (k = 1; k <= 100; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    // the clock ticks once: the hits and the insertions below share a time
+    // after the one of 51..100.
+    usleep(300000);
+    for (k = 1; k <= 50; k++) {
+        l_cache_get(&lc, L_INT_TO_PTR (k));
+    }
+    for (k = 101; k <= 150; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (100 == stats.length, "sampled LRU capacity exceeded");
+    ret_fail_unless (50 == stats.evictions, "sampled LRU lost count of its evictions");
+    for (k = 1; k <= 50; k++) {
+        kept += NULL != l_cache_get(&lc, L_INT_TO_PTR (k));
+    }
+    ret_fail_unless (kept >= 45, "sampled LRU evicted recently used items");
+    l_cache_destroy(&lc);
+
+    ret_fail_unless (NULL != l_cache_new_full(&lc, L_CACHE_RR, 10, 0, 0),
+                     "l_cache_new_full failed");
+    for (k = 1; k <= 100; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+        ret_fail_unless (k == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (k))),
+                         "RR evicted the new item");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (10 == stats.length, "RR capacity exceeded");
+    ret_fail_unless (90 == stats.evictions, "RR lost count of its evictions");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static lpointer
+create_slowly (lconstpointer key)
+{
+    usleep(20000);
+    return (lpointer)key;
+}
+
+static lpointer
+create_quickly (lconstpointer key)
+{
+    return (lpointer)key;
+}
+
+int
+test_l_cache_gdsf (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i, k;
+
+    ret_fail_unless (NULL != l_cache_new_full(&lc, L_CACHE_GDSF, 4, 0, 0),
+                     "l_cache_new_full failed");
+    // an expensive item outlives a stream of cheap ones of the same recency.
+    l_cache_get_or_put(&lc, L_INT_TO_PTR (1), create_slowly);
+    for (k = 2; k < 100; k++) {
+        l_cache_get_or_put(&lc, L_INT_TO_PTR (k), create_quickly);
+    }
+    ret_fail_unless (1 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (1))),
+                     "GDSF evicted the expensive item");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (4 == stats.length, "GDSF capacity exceeded");
+    ret_fail_unless (99 == stats.loads, "GDSF lost count of the loads");
+    ret_fail_unless (stats.load_time >= 20000, "GDSF did not time the creator");
+    ret_fail_unless (stats.evicted_cost < stats.load_time / 2, "GDSF evicted the expensive item");
+    ret_fail_unless (stats.inflation > 0, "GDSF priorities never inflated");
+
+    // a large item goes before small ones of the same cost.
+    for (k = 200; k < 204; k++) {
+        l_cache_put_with_cost(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k), 1e6, k == 200 ? 1000 : 1);
+    }
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (200)), "GDSF kept the large item");
+    for (k = 201; k < 204; k++) {
+        ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (k)), "GDSF evicted a small item");
+    }
+    l_cache_destroy(&lc);
+
+    // a victim spared by admission does not inflate the priorities.
+    l_cache_options_init(&options);
+    options.type = L_CACHE_GDSF;
+    options.capacity = 10;
+    options.admission = true;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < 5; i++) {
+        for (k = 1; k <= 10; k++) {
+            if (NULL == l_cache_get(&lc, L_INT_TO_PTR (k))) {
+                l_cache_put_with_cost(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k), 1e6, 1);
+            }
+        }
+    }
+    for (k = 100; k < 200; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (stats.admission_rejections > 0, "admission never rejected a scan");
+    ret_fail_unless (0 == stats.inflation, "GDSF inflated for a rejected candidate");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static void *
+hammer_cache (void * data)
+{
+    LCache ** lc = data;
+    unsigned int seed = (unsigned int)(uintptr_t)pthread_self();
+    int i, k;
+
+    for (i = 0; i < 100000; i++) {
+        k = rand_r(&seed) % 1000 + 1;
+        if (i % 10) {
+            lpointer value = l_cache_get(lc, L_INT_TO_PTR (k));
+            if (NULL != value && k != L_PTR_TO_INT (value)) {
+                return value;
+            }
+        } else {
+            l_cache_put(lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+        }
+    }
+    return NULL;
+}
+
+int
+test_l_cache_sharded (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    pthread_t threads[4];
+    lpointer failure;
+    int i;
+
+    l_cache_options_init(&options);
+    options.capacity = 256;
+    options.shards = 3;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options),
+                     "shard count must be a power of two");
+    options.shards = 8;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        ret_fail_unless (0 == pthread_create(&threads[i], NULL, hammer_cache, &lc),
+                         "pthread_create failed");
+    }
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        pthread_join(threads[i], &failure);
+        ret_fail_unless (NULL == failure, "sharded cache returned a wrong value");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (256 == stats.capacity, "shards lost part of the capacity");
+    ret_fail_unless (stats.length <= 256 && stats.length == l_cache_get_length(&lc),
+                     "sharded cache capacity exceeded");
+    ret_fail_unless (4 * 90000 == stats.hits + stats.misses, "sharded cache lost lookups");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+int
+test_l_cache_lock_free_reads (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    pthread_t threads[4];
+    lpointer failure;
+    int i;
+
+    l_cache_options_init(&options);
+    options.type = L_CACHE_SLRU;
+    options.capacity = 256;
+    options.shards = 4;
+    options.lock_free_reads = true;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options),
+                     "SLRU hits cannot run without the lock");
+    options.type = L_CACHE_CAR;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        ret_fail_unless (0 == pthread_create(&threads[i], NULL, hammer_cache, &lc),
+                         "pthread_create failed");
+    }
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        pthread_join(threads[i], &failure);
+        ret_fail_unless (NULL == failure, "lock-free read returned a wrong value");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (stats.length <= 256, "lock-free cache capacity exceeded");
+    ret_fail_unless (stats.evictions > 0, "lock-free cache never evicted");
+    ret_fail_unless (4 * 90000 == stats.hits + stats.misses, "lock-free reads lost lookups");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static int creator_calls[2] = { 0, 0 };
+static pthread_barrier_t loaders_ready;
+
+static lpointer
+create_once (lconstpointer key)
+{
+    __atomic_add_fetch(&creator_calls[L_PTR_TO_INT (key) % 2], 1, __ATOMIC_RELAXED);
+    usleep(100000);
+    // odd keys fail to load.
+    return L_PTR_TO_INT (key) % 2 ? NULL : (lpointer)key;
+}
+
+static void *
+load_concurrently (void * data)
+{
+    LCache ** lc = data;
+    lpointer value;
+
+    pthread_barrier_wait(&loaders_ready);
+    value = l_cache_get_or_put(lc, L_INT_TO_PTR (2), create_once);
+    if (2 != L_PTR_TO_INT (value)) {
+        return lc;
+    }
+    pthread_barrier_wait(&loaders_ready);
+    value = l_cache_get_or_put(lc, L_INT_TO_PTR (3), create_once);
+    return value;
+}
+
+int
+test_l_cache_single_flight (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    pthread_t threads[4];
+    lpointer failure;
+    int i;
+
+    l_cache_options_init(&options);
+    options.capacity = 16;
+    options.shards = 2;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    pthread_barrier_init(&loaders_ready, NULL, L_N_ELEMENTS (threads));
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        ret_fail_unless (0 == pthread_create(&threads[i], NULL, load_concurrently, &lc),
+                         "pthread_create failed");
+    }
+    for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+        pthread_join(threads[i], &failure);
+        ret_fail_unless (NULL == failure, "a waiter got a wrong value");
+    }
+    pthread_barrier_destroy(&loaders_ready);
+
+    l_cache_get_stats(&lc, &stats);
+    // a late caller of the failing key may load it again, the cached key 2 never.
+    ret_fail_unless (1 == creator_calls[0], "concurrent misses ran the creator again");
+    ret_fail_unless (creator_calls[0] + creator_calls[1] == stats.loads,
+                     "single-flight lost count of the loads");
+    ret_fail_unless (1 <= stats.coalesced_loads, "single-flight did not coalesce the misses");
+    ret_fail_unless (2 == stats.length, "a failed load was not cached");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static double
+elapsed_since (const struct timespec * start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+test_l_cache_cleaner (void)
+{
+    LCache * first = NULL;
+    LCache * second = NULL;
+    struct timespec start;
+    int k, waited;
+
+    // each cache owns its cleaner: starting and stopping one is immediate
+    // and leaves the other running.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret_fail_unless (NULL != l_cache_new_full(&first, L_CACHE_LRU, 0, 1, 1),
+                     "l_cache_new_full failed");
+    ret_fail_unless (NULL != l_cache_new_full(&second, L_CACHE_LRU, 0, 1, 1),
+                     "l_cache_new_full failed");
+    for (k = 1; k <= 10; k++) {
+        l_cache_put(&second, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    l_cache_destroy(&first);
+    ret_fail_unless (elapsed_since(&start) < 0.5, "cleaner start or stop is slow");
+
+    for (waited = 0; waited < 50 && l_cache_get_length(&second) > 0; waited++) {
+        usleep(100000);
+    }
+    ret_fail_unless (0 == l_cache_get_length(&second), "cleaner stopped with another cache");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    l_cache_destroy(&second);
+    ret_fail_unless (elapsed_since(&start) < 0.5, "cleaner stop is slow");
+    return 0;
+}
+
+int
+test_l_cache_admission_ttl (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i, k;
+
+    // candidates the sketch rejects must leave the timing wheel too.
+    l_cache_options_init(&options);
+    options.type = L_CACHE_LRU;
+    options.capacity = 10;
+    options.admission = true;
+    options.ttl = 60;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < 5; i++) {
+        for (k = 1; k < 10; k++) {
+            if (NULL == l_cache_get(&lc, L_INT_TO_PTR (k))) {
+                l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+            }
+        }
+    }
+    // 100 is rejected, and 101, filed next to it in the wheel, admitted.
+    for (i = 0; i < 8; i++) {
+        l_cache_get(&lc, L_INT_TO_PTR (101));
+    }
+    for (k = 100; k < 103; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (1 == stats.admission_rejections, "admission did not reject the scan");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (101)), "popular candidate rejected");
+
+    // evicting 101 unlinks it from the wheel, next to the rejected item
+    for (k = 1; k < 10; k++) {
+        l_cache_get(&lc, L_INT_TO_PTR (k));
+    }
+    for (i = 0; i < 15; i++) {
+        l_cache_get(&lc, L_INT_TO_PTR (103));
+    }
+    for (k = 103; k < 105; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (101)), "LRU victim not evicted");
+    ret_fail_unless (10 == l_cache_get_length(&lc), "admission window exceeded the capacity");
+    l_cache_destroy(&lc);
+
+    // the sweep thread expires the wheel while the candidates are filed in it.
+    options.ttl = 1;
+    options.cleanup = 1;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < 250; i++) {
+        for (k = 0; k < 100; k++) {
+            l_cache_put(&lc, L_INT_TO_PTR (i * 100 + k), L_INT_TO_PTR (k + 1));
+            l_cache_get(&lc, L_INT_TO_PTR (k));
+        }
+        usleep(10000);
+    }
+    ret_fail_unless (10 >= l_cache_get_length(&lc), "admission window exceeded the capacity");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static void *
+hammer_hot_key (void * data)
+{
+    LCache ** lc = data;
+    unsigned int seed = (unsigned int)(uintptr_t)pthread_self();
+    int i, k;
+
+    // every other access goes to key 1
+    for (i = 0; i < 100000; i++) {
+        k = i % 2 ? 1 : rand_r(&seed) % 1000 + 1;
+        if (i % 10) {
+            lpointer value = l_cache_get(lc, L_INT_TO_PTR (k));
+            if (NULL != value && k != L_PTR_TO_INT (value)) {
+                return value;
+            }
+        } else {
+            l_cache_put(lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+        }
+    }
+    return NULL;
+}
+
+int
+test_l_cache_hot_key (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    struct timespec start;
+    void * (*workloads[]) (void *) = { hammer_cache, hammer_hot_key };
+    double elapsed[L_N_ELEMENTS (workloads)];
+    pthread_t threads[4];
+    lpointer failure;
+    int i, w;
+
+    // lock-free reads of a key taking half of the traffic keep up with
+    // reads spread over the keys.
+    l_cache_options_init(&options);
+    options.type = L_CACHE_CAR;
+    options.capacity = 256;
+    options.shards = 4;
+    options.lock_free_reads = true;
+    for (w = 0; w < L_N_ELEMENTS (workloads); w++) {
+        ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                         "l_cache_new_with_options failed");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+            ret_fail_unless (0 == pthread_create(&threads[i], NULL, workloads[w], &lc),
+                             "pthread_create failed");
+        }
+        for (i = 0; i < L_N_ELEMENTS (threads); i++) {
+            pthread_join(threads[i], &failure);
+            ret_fail_unless (NULL == failure, "lock-free read returned a wrong value");
+        }
+        elapsed[w] = elapsed_since(&start);
+        l_cache_destroy(&lc);
+    }
+    ret_fail_unless (elapsed[1] < 3 * elapsed[0], "reads of a hot key collapsed");
+    return 0;
+}
+
+int
+test_l_cache_lazy_expiration (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int k;
+
+    // no cleanup thread: l_cache_get() drops what it finds expired and
+    // each l_cache_put() expires at most 4 items.
+    l_cache_options_init(&options);
+    options.ttl = 1;
+    options.expire_batch = 4;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (k = 1; k <= 20; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    ret_fail_unless (20 == l_cache_get_length(&lc), "items expired early");
+    sleep(2);
+
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (1)), "lookup returned an expired item");
+    ret_fail_unless (19 == l_cache_get_length(&lc), "lookup kept an expired item");
+    l_cache_put(&lc, L_INT_TO_PTR (100), L_INT_TO_PTR (100));
+    ret_fail_unless (l_cache_get_length(&lc) >= 16, "an insertion expired more than its batch");
+    for (k = 101; k < 110; k++) {
+        l_cache_put(&lc, L_INT_TO_PTR (k), L_INT_TO_PTR (k));
+    }
+    ret_fail_unless (10 == l_cache_get_length(&lc), "insertions left expired items");
+
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (20 == stats.expirations, "expirations not counted");
+    ret_fail_unless (stats.expire_time_max > 0, "expiration steps not timed");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static int batch_calls = 0;
+static int batch_keys = 0;
+
+static void
+create_batch (lconstpointer * keys, lpointer * values, int count)
+{
+    int i;
+
+    batch_calls++;
+    batch_keys += count;
+    for (i = 0; i < count; i++) {
+        // multiples of 7 do not exist in the backend
+        values[i] = L_PTR_TO_INT (keys[i]) % 7 ? (lpointer) keys[i] : NULL;
+    }
+}
+
+int
+test_l_cache_batches (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    lpointer keys[300];
+    lpointer values[300];
+    int k, loadable;
+
+    l_cache_options_init(&options);
+    options.capacity = 1024;
+    options.shards = 4;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (k = 0; k < 300; k++) {
+        keys[k] = L_INT_TO_PTR (k + 1);
+        values[k] = L_INT_TO_PTR (-(k + 1));
+    }
+    ret_fail_unless (100 == l_cache_put_many(&lc, keys, values, 100), "l_cache_put_many failed");
+    ret_fail_unless (100 == l_cache_get_length(&lc), "l_cache_put_many lost items");
+    ret_fail_unless (100 == l_cache_get_many(&lc, (lconstpointer *) keys, values, 150),
+                     "l_cache_get_many failed");
+    for (k = 0; k < 150; k++) {
+        ret_fail_unless (values[k] == (k < 100 ? L_INT_TO_PTR (-(k + 1)) : NULL),
+                         "l_cache_get_many returned a wrong value");
+    }
+
+    // the 200 misses go to the creator in groups of at most 256 keys
+    for (k = 101, loadable = 0; k <= 300; k++) {
+        loadable += k % 7 != 0;
+    }
+    ret_fail_unless (100 + loadable == l_cache_get_or_put_many(&lc, keys, values, 300, create_batch),
+                     "l_cache_get_or_put_many failed");
+    ret_fail_unless (2 == batch_calls && 200 == batch_keys, "misses not batched");
+    for (k = 0; k < 300; k++) {
+        lpointer expected = k < 100 ? L_INT_TO_PTR (-(k + 1)) :
+                            (k + 1) % 7 ? keys[k] : NULL;
+        ret_fail_unless (values[k] == expected, "l_cache_get_or_put_many returned a wrong value");
+    }
+    ret_fail_unless (100 + loadable == l_cache_get_length(&lc), "a failed load was cached");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (200 == stats.loads, "batch loads not counted");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static int refresh_version = 0;
+
+static lpointer
+create_version (lconstpointer key)
+{
+    L_UNUSED_VAR (key);
+    usleep(200000);
+    return L_INT_TO_PTR (__atomic_add_fetch(&refresh_version, 1, __ATOMIC_RELAXED));
+}
+
+int
+test_l_cache_refresh_ahead (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    struct timespec start;
+    lpointer val;
+    int waited;
+
+    // values stored for more than a tenth of their 10 seconds of life are
+    // served as they are and reloaded in the background.
+    l_cache_options_init(&options);
+    options.capacity = 16;
+    options.shards = 2;
+    options.ttl = 10;
+    options.refresh_ahead = 0.1;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    val = l_cache_get_or_put(&lc, L_INT_TO_PTR (1), create_version);
+    ret_fail_unless (1 == L_PTR_TO_INT (val), "first load failed");
+    sleep(2);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    val = l_cache_get_or_put(&lc, L_INT_TO_PTR (1), create_version);
+    ret_fail_unless (1 == L_PTR_TO_INT (val), "the current value was not served");
+    ret_fail_unless (elapsed_since(&start) < 0.1, "the caller waited for the reload");
+    val = l_cache_get_or_put(&lc, L_INT_TO_PTR (1), create_version);
+    for (waited = 0; waited < 20 && 2 != L_PTR_TO_INT (val); waited++) {
+        usleep(100000);
+        val = l_cache_get(&lc, L_INT_TO_PTR (1));
+    }
+    ret_fail_unless (2 == L_PTR_TO_INT (val), "the value was not reloaded");
+
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (1 == stats.refreshes, "a reload was queued twice");
+    ret_fail_unless (2 == stats.loads, "reloads not counted as loads");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static void *
+read_twice (void * data)
+{
+    LCache ** lc = data;
+
+    l_cache_get(lc, L_INT_TO_PTR (1));
+    l_cache_get(lc, L_INT_TO_PTR (1));
+    return NULL;
+}
+
+int
+test_l_cache_front (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    pthread_t thread;
+    int i;
+
+    l_cache_options_init(&options);
+    options.capacity = 16;
+    options.shards = 2;
+    options.front_slots = 64;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (10));
+    for (i = 0; i < 5; i++) {
+        ret_fail_unless (10 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (1))),
+                         "front cache returned a wrong value");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (2 == stats.hits && 3 == stats.front_hits, "value not promoted on its second hit");
+
+    // a write to the shared cache invalidates the copies; the key is still
+    // the candidate of its slot and comes back at once
+    l_cache_put(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (20));
+    ret_fail_unless (20 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (1))),
+                     "front cache kept an overwritten value");
+    ret_fail_unless (20 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (1))), "front hit failed");
+
+    // each thread has its own table, and its hits outlive it
+    ret_fail_unless (0 == pthread_create(&thread, NULL, read_twice, &lc), "pthread_create failed");
+    pthread_join(thread, NULL);
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (4 == stats.front_hits, "front hits lost");
+    ret_fail_unless (5 == stats.hits, "another thread used this thread's table");
+    l_cache_destroy(&lc);
+
+    // a copy expires with its item, which the front hits do not keep alive.
+    options.expire_batch = 16;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put_with_ttl(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (10), 50);
+    for (i = 0; i < 3; i++) {
+        ret_fail_unless (10 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (1))),
+                         "front cache returned a wrong value");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (1 == stats.front_hits, "value with a ttl not promoted");
+    usleep(100000);
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (1)), "front cache kept an expired value");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+int
+test_l_cache_put_with_ttl (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+
+    // no cache wide ttl: only the pairs given one expire, to the
+    // millisecond, on a clock the timer thread updates every 5 ms.
+    l_cache_options_init(&options);
+    options.expire_batch = 16;
+    options.clock_resolution = 5;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put_with_ttl(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (1), 100);
+    l_cache_put_with_ttl(&lc, L_INT_TO_PTR (2), L_INT_TO_PTR (2), 0);
+    l_cache_put(&lc, L_INT_TO_PTR (3), L_INT_TO_PTR (3));
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (1)), "pair expired early");
+    usleep(300000);
+
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (1)), "pair outlived its ttl");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (2)), "pair without ttl expired");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (3)), "pair of the cache ttl expired");
+
+    // overwriting a pair restarts it with its new ttl
+    l_cache_put_with_ttl(&lc, L_INT_TO_PTR (2), L_INT_TO_PTR (2), 50);
+    usleep(200000);
+    l_cache_put(&lc, L_INT_TO_PTR (4), L_INT_TO_PTR (4));
+    ret_fail_unless (2 == l_cache_get_length(&lc), "insertion left an expired pair");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (2 == stats.expirations, "expirations not counted");
+    l_cache_destroy(&lc);
+
+    // the cached clock holds still between two updates: a pair of 1 ms
+    // stored just after one is still there 50 ms later.
+    options.clock_resolution = 1000;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put_with_ttl(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (1), 1);
+    usleep(50000);
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (1)), "cached clock moved between updates");
+    l_cache_destroy(&lc);
+
+    options.ttl = -1;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options), "negative ttl accepted");
+    return 0;
+}
+
+int
+test_l_cache_flat_storage (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i;
+
+    // a full cache keeps replacing its items in the table it was sized for
+    l_cache_options_init(&options);
+    options.capacity = 100;
+    options.flat_storage = true;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 1; i <= 5000; i++) {
+        l_cache_put(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i * 2));
+        ret_fail_unless (i * 2 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (i))),
+                         "new key not found");
+    }
+    ret_fail_unless (100 == l_cache_get_length(&lc), "capacity not enforced");
+    for (i = 4901; i <= 5000; i++) {
+        ret_fail_unless (i * 2 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (i))),
+                         "recent key lost");
+    }
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (4900)), "LRU key not evicted");
+    l_cache_put(&lc, L_INT_TO_PTR (4950), L_INT_TO_PTR (1));
+    ret_fail_unless (1 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (4950))), "overwrite lost");
+    l_cache_destroy(&lc);
+
+    // an unbounded cache grows its table; the items move over the next
+    // operations and stay reachable meanwhile
+    l_cache_options_init(&options);
+    options.flat_storage = true;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 1; i <= 5000; i++) {
+        l_cache_put(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+        ret_fail_unless ((i + 1) / 2 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR ((i + 1) / 2))),
+                         "key lost while resizing");
+    }
+    ret_fail_unless (5000 == l_cache_get_length(&lc), "items lost while growing");
+    for (i = 1; i <= 5000; i++) {
+        ret_fail_unless (i == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (i))),
+                         "key lost while growing");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (0 < stats.resizes, "resizes not counted");
+    l_cache_destroy(&lc);
+
+    // a size hint avoids the resizes of a cache known to grow
+    options.size_hint = 5000;
+    options.shards = 2;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 1; i <= 5000; i++) {
+        l_cache_put(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i));
+    }
+    ret_fail_unless (5000 == l_cache_get_length(&lc), "items lost in a pre-sized table");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (0 == stats.resizes, "pre-sized table resized");
+    l_cache_destroy(&lc);
+    options.size_hint = -1;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options), "negative size hint accepted");
+    options.size_hint = 0;
+
+    options.lock_free_reads = true;
+    options.shards = 2;
+    options.type = L_CACHE_RR;
+    options.capacity = 16;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options),
+                     "flat storage accepted with lock-free reads");
+    return 0;
+}
+
+int
+test_l_cache_item_slabs (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    int i;
+
+    l_cache_options_init(&options);
+    options.capacity = 1000;
+    options.item_slabs = true;
+    options.expire_batch = 16;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 1; i <= 5000; i++) {
+        l_cache_put_with_ttl(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i), i > 4000 ? 50 : 0);
+    }
+    ret_fail_unless (5000 == L_PTR_TO_INT (l_cache_get(&lc, L_INT_TO_PTR (5000))), "slab item lost");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (1000 == stats.slab_items, "slab items not counted");
+    ret_fail_unless (stats.slab_bytes > 0 && stats.slab_bytes < 1000 * 512, "slabs not shared");
+    ret_fail_unless (stats.slab_occupancy > 0.5 && stats.slab_occupancy <= 1.0,
+                     "evictions left the slabs sparse");
+
+    // the expired items release their slabs
+    usleep(100000);
+    for (i = 4001; i <= 5000; i++) {
+        ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (i)), "item outlived its ttl");
+    }
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (0 == stats.length && 0 == stats.slab_items, "expired items not freed");
+    ret_fail_unless (stats.slab_bytes <= 16384, "empty slabs kept");
+    ret_fail_unless (0.0 == stats.slab_fragmentation, "empty slab counted as fragmented");
+    l_cache_destroy(&lc);
+    return 0;
+}
+
+static size_t
+weigh_value (lconstpointer key, lconstpointer value)
+{
+    L_UNUSED_VAR (key);
+    return (size_t) L_PTR_TO_INT (value);
+}
+
+int
+test_l_cache_weight_budget (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    LCacheStats stats;
+    size_t overhead;
+    int fit, i;
+
+    // values weighing 1000 bytes in a 10000 byte budget, with the item
+    // overhead
+    l_cache_options_init(&options);
+    options.weigher = weigh_value;
+    options.max_weight = 10000;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put(&lc, L_INT_TO_PTR (1), L_INT_TO_PTR (1000));
+    overhead = l_cache_get_weight(&lc) - 1000;
+    ret_fail_unless (overhead > 0 && overhead < 1000, "item overhead not charged");
+    fit = 10000 / (1000 + overhead);
+    for (i = 2; i <= 100; i++) {
+        l_cache_put(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (1000));
+        ret_fail_unless (l_cache_get_weight(&lc) <= 10000, "weight over budget");
+    }
+    ret_fail_unless (fit == l_cache_get_length(&lc), "budget not filled");
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (100 - fit)), "LRU item kept");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (101 - fit)), "item evicted early");
+
+    // a value that grows pushes the least recent ones out
+    l_cache_put(&lc, L_INT_TO_PTR (100), L_INT_TO_PTR (6000));
+    ret_fail_unless (l_cache_get_weight(&lc) <= 10000, "grown value left the weight over budget");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (100)), "grown value evicted");
+    ret_fail_unless (NULL != l_cache_get(&lc, L_INT_TO_PTR (101 - fit)), "recent item evicted");
+    fit = l_cache_get_length(&lc);
+
+    // a value heavier than the budget is not kept
+    l_cache_put(&lc, L_INT_TO_PTR (101), L_INT_TO_PTR (20000));
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (101)), "overweight value kept");
+    ret_fail_unless (fit == l_cache_get_length(&lc), "overweight value evicted others");
+    l_cache_get_stats(&lc, &stats);
+    ret_fail_unless (stats.weight == l_cache_get_weight(&lc) && 10000 == stats.max_weight,
+                     "weight not reported");
+    ret_fail_unless ((fit - 1) * 1000 + 6000 + fit * overhead == stats.weight, "weight out of sync");
+
+    // an overwrite heavier than the budget only drops its own item
+    l_cache_put(&lc, L_INT_TO_PTR (100), L_INT_TO_PTR (20000));
+    ret_fail_unless (NULL == l_cache_get(&lc, L_INT_TO_PTR (100)), "overweight overwrite kept");
+    ret_fail_unless (fit - 1 == l_cache_get_length(&lc), "overweight overwrite evicted others");
+    ret_fail_unless ((fit - 1) * (1000 + overhead) == l_cache_get_weight(&lc), "weight out of sync");
+    l_cache_destroy(&lc);
+
+    // without a weigher the size given to the put is charged, per partition
+    l_cache_options_init(&options);
+    options.type = L_CACHE_SLRU;
+    options.shards = 2;
+    options.max_weight = 1 << 20;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 1; i <= 100; i++) {
+        l_cache_put_with_cost(&lc, L_INT_TO_PTR (i), L_INT_TO_PTR (i), 1.0, 100000);
+    }
+    ret_fail_unless (l_cache_get_weight(&lc) <= 1 << 20, "weight over budget");
+    ret_fail_unless (l_cache_get_length(&lc) >= 8 && l_cache_get_length(&lc) <= 10,
+                     "budget not split between the partitions");
+    l_cache_destroy(&lc);
+
+    options.type = L_CACHE_ARC;
+    options.capacity = 16;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options),
+                     "weight budget accepted by ARC");
+    return 0;
+}
+
+static lpointer
+create_length (lconstpointer key)
+{
+    return L_INT_TO_PTR (strlen(key));
+}
+
+int
+test_l_cache_key_types (void)
+{
+    LCache * lc = NULL;
+    LCacheOptions options;
+    char buffer[64];
+    char other[64];
+    struct { int a; short b; } bkey, bother;
+    int i;
+
+    // copied strings: the caller's buffer is reused, and equal strings at
+    // another address find the item, short or not
+    l_cache_options_init(&options);
+    options.key_type = L_CACHE_KEY_STRING_COPY;
+    options.capacity = 64;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    for (i = 0; i < 100; i++) {
+        snprintf(buffer, sizeof (buffer), i % 2 ? "key %d" : "a key longer than the inline copy %d", i);
+        l_cache_put(&lc, buffer, L_INT_TO_PTR (i + 1));
+    }
+    ret_fail_unless (64 == l_cache_get_length(&lc), "capacity not enforced");
+    for (i = 36; i < 100; i++) {
+        snprintf(other, sizeof (other), i % 2 ? "key %d" : "a key longer than the inline copy %d", i);
+        ret_fail_unless (i + 1 == L_PTR_TO_INT (l_cache_get(&lc, other)), "string key not found");
+    }
+    ret_fail_unless (NULL == l_cache_get(&lc, "key 35"), "evicted string key found");
+    ret_fail_unless (3 == L_PTR_TO_INT (l_cache_get_or_put(&lc, "abc", create_length)),
+                     "string key not loaded");
+    l_cache_destroy(&lc);
+
+    // borrowed strings, over partitions
+    l_cache_options_init(&options);
+    options.key_type = L_CACHE_KEY_STRING;
+    options.shards = 4;
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    l_cache_put(&lc, key[0], L_INT_TO_PTR (vals[0]));
+    strcpy(other, key[0]);
+    ret_fail_unless (vals[0] == L_PTR_TO_INT (l_cache_get(&lc, other)), "borrowed key not found");
+    l_cache_destroy(&lc);
+
+    // fixed size binary keys
+    l_cache_options_init(&options);
+    options.key_type = L_CACHE_KEY_BINARY;
+    options.key_size = sizeof (bkey);
+    ret_fail_unless (NULL != l_cache_new_with_options(&lc, &options),
+                     "l_cache_new_with_options failed");
+    memset(&bkey, 0, sizeof (bkey));
+    memset(&bother, 0, sizeof (bother));
+    bkey.a = bother.a = 7;
+    bkey.b = bother.b = 3;
+    l_cache_put(&lc, &bkey, L_INT_TO_PTR (73));
+    bkey.b = 4;
+    ret_fail_unless (73 == L_PTR_TO_INT (l_cache_get(&lc, &bother)), "binary key not found");
+    ret_fail_unless (NULL == l_cache_get(&lc, &bkey), "binary key matched another");
+    l_cache_destroy(&lc);
+
+    options.type = L_CACHE_PLRU;
+    options.capacity = 64;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options), "binary keys accepted by PLRU");
+    options.type = L_CACHE_LRU;
+    options.key_size = 0;
+    ret_fail_unless (NULL == l_cache_new_with_options(&lc, &options), "empty binary keys accepted");
+    return 0;
+}
+
 int
 main (int argc, char * argv[])
 {
@@ -174,5 +1428,31 @@ main (int argc, char * argv[])
         sleep(2);
     }
     l_cache_destroy(&cache);
+
+    ret_fail_unless (0 == test_l_cache_lru (), "bounded LRU failed");
+    ret_fail_unless (0 == test_l_cache_slru (), "segmented LRU failed");
+    ret_fail_unless (0 == test_l_cache_arc (), "adaptive replacement failed");
+    ret_fail_unless (0 == test_l_cache_car (), "clock with adaptive replacement failed");
+    ret_fail_unless (0 == test_l_cache_lirs (), "LIRS failed");
+    ret_fail_unless (0 == test_l_cache_lfu (), "LFU failed");
+    ret_fail_unless (0 == test_l_cache_plru (), "PLRU failed");
+    ret_fail_unless (0 == test_l_cache_admission (), "TinyLFU admission failed");
+    ret_fail_unless (0 == test_l_cache_sampled (), "sampled eviction failed");
+    ret_fail_unless (0 == test_l_cache_gdsf (), "GDSF failed");
+    ret_fail_unless (0 == test_l_cache_sharded (), "sharded cache failed");
+    ret_fail_unless (0 == test_l_cache_lock_free_reads (), "lock-free reads failed");
+    ret_fail_unless (0 == test_l_cache_single_flight (), "single-flight loading failed");
+    ret_fail_unless (0 == test_l_cache_cleaner (), "per-cache cleaner failed");
+    ret_fail_unless (0 == test_l_cache_admission_ttl (), "admission with ttl failed");
+    ret_fail_unless (0 == test_l_cache_hot_key (), "hot key reads failed");
+    ret_fail_unless (0 == test_l_cache_lazy_expiration (), "thread-free expiration failed");
+    ret_fail_unless (0 == test_l_cache_batches (), "batched calls failed");
+    ret_fail_unless (0 == test_l_cache_refresh_ahead (), "refresh-ahead failed");
+    ret_fail_unless (0 == test_l_cache_front (), "thread-local front cache failed");
+    ret_fail_unless (0 == test_l_cache_put_with_ttl (), "per-pair ttl failed");
+    ret_fail_unless (0 == test_l_cache_flat_storage (), "flat storage failed");
+    ret_fail_unless (0 == test_l_cache_item_slabs (), "item slabs failed");
+    ret_fail_unless (0 == test_l_cache_weight_budget (), "weight budget failed");
+    ret_fail_unless (0 == test_l_cache_key_types (), "key types failed");
     return 0;
 }